@@ -0,0 +1,210 @@
+/**
+ * @brief Micro-benchmarks of string, filter and path lookup hot paths
+ *
+ * Usage: stormex_microbench [CORPUS] [FILTER]
+ *   CORPUS - newline delimited list of paths (such as output of `stormex -l`), generated if not given
+ *   FILTER - run only benchmarks whose name contains this substring
+ *
+ * Each benchmark is repeated until it runs for at least BENCH_MIN_TIME, reported are nanoseconds
+ * and heap allocations per single operation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <regex>
+#include <new>
+#include <algorithm>
+
+#include "util.hpp"
+#include "fstree.hpp"
+
+static const std::chrono::milliseconds BENCH_MIN_TIME(200);
+
+// benchmarks run on a single thread - no need for atomics
+static size_t allocCount = 0;
+
+void* operator new(size_t size)
+{
+    ++allocCount;
+    if (void* ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+// results are accumulated here, so the compiler cannot discard the benchmarked calls
+static volatile size_t sink;
+
+static const char* benchFilter = NULL;
+
+/**
+ * @brief Run fn(i) for increasing number of iterations until it takes long enough, and report per op cost
+ */
+template <typename Fn>
+void bench(const char* name, Fn fn)
+{
+    if (benchFilter && !strstr(name, benchFilter)) return;
+
+    // warm up caches and lazily initialized state
+    for (size_t i = 0; i < 1000; ++i) fn(i);
+
+    size_t iterations = 1000;
+    while (true) {
+        size_t allocsBefore = allocCount;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            fn(i);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        size_t allocs = allocCount - allocsBefore;
+
+        if (elapsed >= BENCH_MIN_TIME) {
+            double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+            printf("%-36s %10.1f ns/op %8.2f allocs/op %12zu ops\n",
+                name, ns / iterations, static_cast<double>(allocs) / iterations, iterations);
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+static const char* corpusDirs[] = {
+    "mods", "Campaigns", "Liberty.SC2Campaign", "Swarm.SC2Campaign", "Core.SC2Mod", "base.sc2data",
+    "enUS.SC2Data", "deDE.SC2Data", "EditorData", "GameData", "Assets", "Textures", "Sounds",
+    "Units", "Terran", "Zerg", "Protoss", "UI", "Layout", "LocalizedData", "Effects", "Portraits",
+};
+
+static const char* corpusFiles[] = {
+    "btn-ability-terran-stimpack.dds", "Marine.m3", "GameStrings.txt", "UnitData.xml", "ZergUnits.xml",
+    "ui_glues_greeting.ogg", "TriggerLibs.galaxy", "DocumentInfo", "Objects", "Preload.xml", "FontStyles.SC2Style",
+};
+
+/**
+ * @brief Deep, mixed case, backslash separated paths resembling those of SC2 storage
+ */
+std::vector<std::string> generateCorpus(size_t count)
+{
+    std::vector<std::string> corpus;
+    srand(1);
+    for (size_t i = 0; i < count; ++i) {
+        std::string path;
+        size_t depth = 3 + rand() % 8;
+        for (size_t d = 0; d < depth; ++d) {
+            path += corpusDirs[rand() % (sizeof(corpusDirs) / sizeof(corpusDirs[0]))];
+            path += '\\';
+        }
+        path += std::to_string(i) + "_" + corpusFiles[rand() % (sizeof(corpusFiles) / sizeof(corpusFiles[0]))];
+        corpus.push_back(path);
+    }
+    return corpus;
+}
+
+std::vector<std::string> readCorpus(const char* filename)
+{
+    std::vector<std::string> corpus;
+    std::ifstream ifs(filename, std::ifstream::in);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.size() && line[line.size() - 1] == '\r') line.resize(line.size() - 1);
+        if (line.size()) corpus.push_back(line);
+    }
+    return corpus;
+}
+
+int main(int argc, char* argv[])
+{
+    auto corpus = argc > 1 && strcmp(argv[1], "-") != 0 ? readCorpus(argv[1]) : generateCorpus(100000);
+    benchFilter = argc > 2 ? argv[2] : NULL;
+    if (corpus.empty()) {
+        fprintf(stderr, "empty corpus\n");
+        return 1;
+    }
+    const size_t n = corpus.size();
+    printf("corpus: %zu paths\n\n", n);
+
+    // same paths as seen by FUSE - '/' separated, rooted, and in different case
+    std::vector<std::string> fusePaths;
+    std::vector<std::string> upperPaths;
+    for (const auto& path : corpus) {
+        std::string fusePath = "/" + path;
+        std::replace(fusePath.begin(), fusePath.end(), '\\', '/');
+        std::replace(fusePath.begin(), fusePath.end(), ':', '/');
+        fusePaths.push_back(fusePath);
+        std::string upperPath = path;
+        std::transform(upperPath.begin(), upperPath.end(), upperPath.begin(), ::toupper);
+        upperPaths.push_back(upperPath);
+    }
+
+    const std::string needleHit = "editordata";
+    const std::string needleMiss = "nonexistent";
+    bench("stringFindIC/hit", [&](size_t i) { sink += stringFindIC(corpus[i % n], needleHit); });
+    bench("stringFindIC/miss", [&](size_t i) { sink += stringFindIC(corpus[i % n], needleMiss); });
+    bench("stringEqualIC", [&](size_t i) { sink += stringEqualIC(corpus[i % n], upperPaths[i % n]); });
+
+    bench("formatFileSize/string", [&](size_t i) { sink += formatFileSize(i * 7919).size(); });
+    bench("formatFileSize/buffer", [&](size_t i) {
+        char buff[32];
+        sink += formatFileSize(buff, i * 7919);
+    });
+
+    unsigned char key[16];
+    for (size_t i = 0; i < sizeof(key); ++i) key[i] = static_cast<unsigned char>(i * 37);
+    std::ostringstream oss;
+    bench("formatBytes", [&](size_t i) {
+        oss.str(std::string());
+        formatBytes(oss, key, sizeof(key), false);
+        sink += static_cast<size_t>(oss.tellp());
+    });
+    bench("bytesToHex", [&](size_t i) {
+        char hex[sizeof(key) * 2 + 1];
+        bytesToHex(hex, key, sizeof(key));
+        sink += hex[i % sizeof(key)];
+    });
+
+    std::vector<std::regex> patterns = {
+        std::regex("\\.(xml|txt|galaxy)$", std::regex::ECMAScript | std::regex::icase),
+        std::regex("(dede|eses|frfr)\\.sc2data", std::regex::ECMAScript | std::regex::icase),
+    };
+    bench("searchRegexMulti", [&](size_t i) { sink += searchRegexMulti(corpus[i % n], patterns); });
+
+    const std::string prefix = "mods/Core.SC2Mod";
+    const std::string glob = "mods/**/GameData/*.xml";
+    bench("pathHasPrefix", [&](size_t i) { sink += pathHasPrefix(corpus[i % n], prefix); });
+    bench("globMatch", [&](size_t i) { sink += globMatch(glob, corpus[i % n]); });
+
+    bench("PathIHasher", [&](size_t i) { sink += PathIHasher()(PathRef(fusePaths[i % n])); });
+
+    FsTree tree;
+    std::vector<CASC_CKEY_ENTRY> ckeyEntries(n);
+    for (size_t i = 0; i < n; ++i) {
+        // distinct, hash-like keys
+        uint64_t ckey = (i + 1) * 0x9E3779B97F4A7C15ULL;
+        memcpy(ckeyEntries[i].CKey, &ckey, sizeof(ckey));
+        memcpy(ckeyEntries[i].CKey + sizeof(ckey), &ckey, sizeof(ckey));
+        auto parentNode = tree.GetParentNodeOfFilename(corpus[i]);
+        size_t pos = corpus[i].find_last_of(":\\");
+        tree.InsertFile(parentNode, pos == std::string::npos ? corpus[i] : corpus[i].substr(pos + 1), &ckeyEntries[i], NULL);
+    }
+
+    bench("FsTree::GetNodeAtPath/hit", [&](size_t i) { sink += tree.GetNodeAtPath(fusePaths[i % n].c_str()) != NULL; });
+    bench("FsTree::GetNodeAtPath/miss", [&](size_t i) { sink += tree.GetNodeAtPath(corpus[i % n].c_str()) != NULL; });
+    bench("FsTree::GetParentNodeOfFilename", [&](size_t i) { sink += tree.GetParentNodeOfFilename(corpus[i % n])->inode; });
+
+    return 0;
+}
@@ -2,4 +2,25 @@
 
 #include "storage.hpp"
 
-int cascfs_mount(const std::string& mountPoint, HANDLE hStorage);
+struct CascfsOptions
+{
+    // Group files under CKEY/ into subdirectories named after the first byte of their key
+    bool shardCKeys = false;
+    // Files and directories whose content is read in the background once mounted
+    std::vector<std::string> warmPatterns;
+    unsigned int warmThreads = 2;
+};
+
+/**
+ * @brief Storage to mount - under a top-level directory of given name, or at the root if the name is empty
+ */
+struct CascfsStorage
+{
+    std::string name;
+    HANDLE hStorage;
+};
+
+/**
+ * @brief Mount storages, sharing content (inodes, open handles) of equal CKeys between all of them
+ */
+int cascfs_mount(const std::string& mountPoint, const std::vector<CascfsStorage>& storages, const CascfsOptions& options);
@@ -0,0 +1,468 @@
+#ifndef __FSTREE_HPP__
+#define __FSTREE_HPP__
+
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#define __CASCLIB_SELF__
+#include "../CascLib/src/CascLib.h"
+#include "../CascLib/src/CascCommon.h"
+#include "common.hpp"
+
+enum class FsNodeKind {
+    Unknown,
+    Root,
+    Folder,
+    File,
+    // virtual file generated by cascfs itself
+    Control,
+};
+
+/**
+ * @brief Non-owning reference to a path, with its normalized hash precomputed
+ *
+ * Comparisons and hashing fold case and treat '/' and '\\' as equal, directly on the
+ * referenced characters - so looking up a `const char*` doesn't require building a `std::string`.
+ */
+struct PathRef
+{
+    const char* str;
+    size_t len;
+    uint64_t hash;
+
+    static inline char FoldChar(char ch)
+    {
+        if (ch == '\\') return '/';
+        if (ch >= 'A' && ch <= 'Z') return ch + ('a' - 'A');
+        return ch;
+    }
+
+    static uint64_t CalcHash(const char* str, size_t len)
+    {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; ++i) {
+            hash ^= static_cast<unsigned char>(FoldChar(str[i]));
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    PathRef(const char* str, size_t len)
+        : str(str), len(len), hash(CalcHash(str, len))
+    {
+    }
+
+    PathRef(const char* str)
+        : PathRef(str, strlen(str))
+    {
+    }
+
+    PathRef(const std::string& str)
+        : PathRef(str.data(), str.size())
+    {
+    }
+};
+
+class PathIHasher
+{
+public:
+    size_t operator()(const PathRef& k) const
+    {
+        return static_cast<size_t>(k.hash);
+    }
+};
+
+class PathIComparator
+{
+public:
+    bool operator()(const PathRef& k1, const PathRef& k2) const
+    {
+        if (k1.hash != k2.hash || k1.len != k2.len) return false;
+        for (size_t i = 0; i < k1.len; ++i) {
+            if (PathRef::FoldChar(k1.str[i]) != PathRef::FoldChar(k2.str[i])) return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Content shared by all file nodes pointing at the same CKey - across all mounted storages
+ */
+struct FsContent
+{
+    // entry of the first storage the content was found in, and the storage it's read from
+    PCASC_CKEY_ENTRY ckeyEntry;
+    HANDLE hStorage;
+    // inode number reported for every node linked to this content
+    uint64_t inode = 0;
+    // number of nodes linked to this content
+    uint32_t nlink = 0;
+};
+
+class ContentKeyHasher
+{
+public:
+    size_t operator()(const BYTE* ckey) const
+    {
+        // already a hash
+        size_t hash;
+        memcpy(&hash, ckey, sizeof(hash));
+        return hash;
+    }
+};
+
+class ContentKeyComparator
+{
+public:
+    bool operator()(const BYTE* ckey1, const BYTE* ckey2) const
+    {
+        return memcmp(ckey1, ckey2, MD5_HASH_SIZE) == 0;
+    }
+};
+
+class FsNode;
+
+// keys reference strings owned by the nodes themselves, which never change once inserted
+typedef std::unordered_map<PathRef, FsNode*, PathIHasher, PathIComparator> FsNodeMap;
+
+class FsNode {
+    std::string m_name;
+    std::string m_filename;
+    FsNode* m_parent = NULL;
+    FsNodeMap m_children;
+    // same nodes as in m_children, but in insertion order - allows readdir to resume at given offset
+    std::vector<FsNode*> m_entries;
+public:
+    const FsNodeKind m_kind = FsNodeKind::Unknown;
+    uint64_t inode = 0;
+    FsContent* content = NULL;
+
+    FsNode(FsNodeKind nKind, std::string name, FsNode *parent)
+        : m_kind(nKind), m_name(name), m_parent(parent)
+    {
+        // full path is built once, from the path of the parent - nodes are never moved
+        const std::string& parentPath = parent->Filepath();
+        m_filename.reserve(parentPath.size() + 1 + m_name.size());
+        m_filename = parentPath;
+        if (parent->m_kind != FsNodeKind::Root) m_filename += '/';
+        m_filename += m_name;
+    }
+
+    FsNode(FsNodeKind nKind = FsNodeKind::Root)
+        : m_kind(nKind), m_name("/"), m_filename("/")
+    {
+    }
+
+    void Insert(FsNode* childNode)
+    {
+        assert(m_kind != FsNodeKind::File);
+        auto& slot = m_children[PathRef(childNode->Name())];
+        if (slot != NULL) {
+            std::replace(m_entries.begin(), m_entries.end(), slot, childNode);
+        }
+        else {
+            m_entries.push_back(childNode);
+        }
+        slot = childNode;
+    }
+
+    FsNode *Insert(FsNodeKind nKind, const std::string& name)
+    {
+        auto childNode = new FsNode(nKind, name, this);
+        Insert(childNode);
+        return childNode;
+    }
+
+    const FsNodeMap& Children()
+    {
+        return m_children;
+    }
+
+    const std::vector<FsNode*>& Entries()
+    {
+        return m_entries;
+    }
+
+    const std::string& Name()
+    {
+        return m_name;
+    }
+
+    FsNode* Parent()
+    {
+        return m_parent;
+    }
+
+    const std::string& Filepath()
+    {
+        return m_filename;
+    }
+};
+
+/**
+ * @brief Tree of nodes, with an index of their full paths
+ *
+ * Nodes are indexed as they're inserted. Insertion is safe from multiple threads, as long as each of them
+ * inserts into a different subtree - the path index and contents are split into shards with their own locks.
+ * Lookups don't lock, and must not run concurrently with insertion.
+ */
+class FsTree {
+    static const size_t SHARD_COUNT = 64;
+
+    struct NodeShard
+    {
+        std::mutex mutex;
+        FsNodeMap nodes;
+    };
+
+    struct ContentShard
+    {
+        std::mutex mutex;
+        // keys point to CKey of the entry held by the content
+        std::unordered_map<const BYTE*, FsContent*, ContentKeyHasher, ContentKeyComparator> contents;
+    };
+
+    const size_t m_openFileLimit = 128;
+    FsNode m_rootNode;
+    NodeShard m_nodeShards[SHARD_COUNT];
+    ContentShard m_contentShards[SHARD_COUNT];
+    // handles are opened per content, rather than per node - so all paths leading to the same CKey share them
+    std::unordered_map<FsContent*, HANDLE> m_openFiles;
+    std::atomic<uint64_t> m_nextInode{1};
+    std::atomic<uint64_t> m_handleHits{0};
+    std::atomic<uint64_t> m_handleMisses{0};
+
+    static NodeShard& NodeShardOf(NodeShard* shards, const PathRef& path)
+    {
+        // upper bits - lower ones pick the bucket within the shard
+        return shards[(path.hash >> 58) % SHARD_COUNT];
+    }
+
+    void IndexNode(FsNode* fNode)
+    {
+        PathRef path(fNode->Filepath());
+        auto& shard = NodeShardOf(m_nodeShards, path);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto result = shard.nodes.emplace(path, fNode);
+        if (!result.second) {
+            // replaced node - the key references the path owned by the previous one
+            shard.nodes.erase(result.first);
+            shard.nodes.emplace(path, fNode);
+        }
+    }
+
+    ContentShard& ContentShardOf(const BYTE* ckey)
+    {
+        // bytes other than those used by the hasher
+        return m_contentShards[ckey[MD5_HASH_SIZE - 1] % SHARD_COUNT];
+    }
+
+    FsContent* AcquireContent(PCASC_CKEY_ENTRY ckeyEntry, HANDLE hStorage)
+    {
+        auto& shard = ContentShardOf(ckeyEntry->CKey);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto& content = shard.contents[ckeyEntry->CKey];
+        if (content == NULL) {
+            content = new FsContent();
+            content->ckeyEntry = ckeyEntry;
+            content->hStorage = hStorage;
+            content->inode = m_nextInode.fetch_add(1, std::memory_order_relaxed);
+        }
+        ++content->nlink;
+        return content;
+    }
+
+    void ReleaseContent(FsContent* content)
+    {
+        auto& shard = ContentShardOf(content->ckeyEntry->CKey);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (--content->nlink == 0) {
+            shard.contents.erase(content->ckeyEntry->CKey);
+            delete content;
+        }
+    }
+
+public:
+    FsNode* GetRootNode() { return &m_rootNode; }
+
+    FsTree()
+        : m_rootNode(FsNodeKind::Root)
+    {
+        m_rootNode.inode = m_nextInode++;
+        IndexNode(&m_rootNode);
+    }
+
+    FsNode* InsertFolder(FsNode* parentNode, const std::string& name)
+    {
+        auto folderNode = parentNode->Insert(FsNodeKind::Folder, name);
+        folderNode->inode = m_nextInode.fetch_add(1, std::memory_order_relaxed);
+        IndexNode(folderNode);
+        return folderNode;
+    }
+
+    FsNode* InsertControl(FsNode* parentNode, const std::string& name)
+    {
+        auto controlNode = parentNode->Insert(FsNodeKind::Control, name);
+        controlNode->inode = m_nextInode.fetch_add(1, std::memory_order_relaxed);
+        IndexNode(controlNode);
+        return controlNode;
+    }
+
+    /**
+     * @brief Insert file with content of given CKey entry - content already present in the tree (from any storage) is shared
+     */
+    FsNode* InsertFile(FsNode* parentNode, const std::string& name, PCASC_CKEY_ENTRY ckeyEntry, HANDLE hStorage)
+    {
+        auto content = AcquireContent(ckeyEntry, hStorage);
+        // file of the same path replaces the previous one, which no longer links to its content
+        auto existingNode = parentNode->Children().find(PathRef(name));
+        if (existingNode != parentNode->Children().end() && existingNode->second->content != NULL) {
+            ReleaseContent(existingNode->second->content);
+            existingNode->second->content = NULL;
+        }
+        auto fileNode = parentNode->Insert(FsNodeKind::File, name);
+        fileNode->inode = content->inode;
+        fileNode->content = content;
+        IndexNode(fileNode);
+        return fileNode;
+    }
+
+    uint64_t GetHandleHits() const { return m_handleHits.load(std::memory_order_relaxed); }
+    uint64_t GetHandleMisses() const { return m_handleMisses.load(std::memory_order_relaxed); }
+
+    size_t GetContentCount()
+    {
+        size_t count = 0;
+        for (const auto& shard : m_contentShards) {
+            count += shard.contents.size();
+        }
+        return count;
+    }
+
+    size_t GetNodeCount()
+    {
+        size_t count = 0;
+        for (const auto& shard : m_nodeShards) {
+            count += shard.nodes.size();
+        }
+        return count;
+    }
+
+    /**
+     * @brief Rough estimate of heap memory held by nodes of the tree and its indexes
+     */
+    size_t EstimateMemoryUsage(FsNode* fNode)
+    {
+        // node of unordered_map: key, value, next pointer and cached hash
+        const size_t mapNodeSize = sizeof(PathRef) + sizeof(FsNode*) + 2 * sizeof(void*);
+
+        size_t total = sizeof(FsNode) + fNode->Name().capacity() + fNode->Filepath().capacity();
+        total += fNode->Children().bucket_count() * sizeof(void*) + fNode->Children().size() * mapNodeSize;
+        total += fNode->Entries().capacity() * sizeof(FsNode*);
+        for (auto childNode : fNode->Entries()) {
+            total += EstimateMemoryUsage(childNode);
+        }
+
+        if (fNode == GetRootNode()) {
+            for (const auto& shard : m_nodeShards) {
+                total += shard.nodes.bucket_count() * sizeof(void*) + shard.nodes.size() * mapNodeSize;
+            }
+            for (const auto& shard : m_contentShards) {
+                total += shard.contents.bucket_count() * sizeof(void*);
+                total += shard.contents.size() * (sizeof(FsContent) + sizeof(const BYTE*) + sizeof(FsContent*) + 2 * sizeof(void*));
+            }
+        }
+
+        return total;
+    }
+
+    FsNode* GetNodeAtPath(const char* path)
+    {
+        PathRef pathRef(path);
+        auto& nodes = NodeShardOf(m_nodeShards, pathRef).nodes;
+        auto fNode = nodes.find(pathRef);
+        if (fNode != nodes.end()) {
+            return fNode->second;
+        }
+        return NULL;
+    }
+
+    /**
+     * @brief Walk CASC directory path (':' or '\\' separated) from baseNode, creating missing folders along the way
+     *
+     * @param dirname path of the directory, without trailing separator
+     * @param len
+     */
+    FsNode* GetFolderNode(FsNode* baseNode, const char* dirname, size_t len)
+    {
+        auto currentNode = baseNode;
+        size_t pos_start = 0;
+        while (pos_start < len) {
+            size_t pos_end = pos_start;
+            while (pos_end < len && dirname[pos_end] != ':' && dirname[pos_end] != '\\') ++pos_end;
+
+            PathRef component(dirname + pos_start, pos_end - pos_start);
+            auto folderNodeEntry = currentNode->Children().find(component);
+            if (folderNodeEntry != currentNode->Children().end()) {
+                currentNode = folderNodeEntry->second;
+            }
+            else {
+                currentNode = InsertFolder(currentNode, std::string(component.str, component.len));
+            }
+            pos_start = pos_end + 1;
+        }
+
+        return currentNode;
+    }
+
+    FsNode* GetParentNodeOfFilename(const std::string& filename)
+    {
+        size_t pos = filename.find_last_of(":\\");
+        if (pos == std::string::npos) return GetRootNode();
+        return GetFolderNode(GetRootNode(), filename.data(), pos);
+    }
+
+    HANDLE GetNodeHandle(FsNode* fNode)
+    {
+        auto result = m_openFiles.find(fNode->content);
+        if (result != m_openFiles.end()) {
+            m_handleHits.fetch_add(1, std::memory_order_relaxed);
+            return result->second;
+        }
+        else {
+            m_handleMisses.fetch_add(1, std::memory_order_relaxed);
+            if (m_openFiles.size() >= m_openFileLimit) {
+                LOG_DEBUG << "Open files limit reached (" << m_openFileLimit << "). Closing first half..";
+                for (auto it = m_openFiles.cbegin(); it != m_openFiles.end();) {
+                    if (m_openFiles.size() > m_openFileLimit / 2) {
+                        LOG_VERBOSE << "Closing: " << static_cast<void*>(it->first->ckeyEntry);
+                        CascCloseFile(it->second);
+                        it = m_openFiles.erase(it);
+                    }
+                    else {
+                        // ++it;
+                        break;
+                    }
+                }
+            }
+
+            HANDLE hFile;
+            if (!CascOpenFile(fNode->content->hStorage, fNode->content->ckeyEntry->CKey, CASC_LOCALE_ALL, CASC_OPEN_BY_CKEY, &hFile)) {
+                LOG_ERROR << "Couldn't open file " << fNode->Filepath();
+                return NULL;
+            }
+            m_openFiles[fNode->content] = hFile;
+
+            return hFile;
+        }
+    }
+};
+
+#endif // __FSTREE_HPP__
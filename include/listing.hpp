@@ -0,0 +1,94 @@
+#ifndef __LISTING_HPP__
+#define __LISTING_HPP__
+
+#include <string>
+#include "storage.hpp"
+#include "output.hpp"
+
+enum class ListFormat {
+    // human readable, the default
+    Text,
+    // name, CKey, EKey and size separated by tabs
+    Tsv,
+    // JSON object per line
+    Ndjson,
+    // length-prefixed binary records - see README for the layout
+    Bin,
+};
+
+/**
+ * @brief Total size and number of files contained under a directory
+ */
+struct DirectorySummary
+{
+    std::string name;
+    uint64_t size;
+    uint64_t files;
+};
+
+enum class DiffStatus : char {
+    Added = 'A',
+    Removed = 'D',
+    Changed = 'M',
+};
+
+/**
+ * @brief File which differs between two storages
+ */
+struct FileChange
+{
+    DiffStatus status;
+    // in case of removed files it comes from the base storage
+    STORAGE_SEARCH_RESULT* entry;
+};
+
+/**
+ * @brief Parse name of the format as given on the command line
+ *
+ * @param name
+ * @param format
+ * @return false if name is not recognized
+ */
+bool parseListFormat(const std::string& name, ListFormat& format);
+
+/**
+ * @brief Append entry to out, encoded as a record of ListFormat::Bin
+ *
+ * @param out
+ * @param entry
+ * @param fileSize size stored in the record
+ * @return false if the name doesn't fit u16 length - nothing is appended
+ */
+bool appendBinRecord(std::string& out, const STORAGE_SEARCH_RESULT& entry, uint64_t fileSize);
+
+inline bool appendBinRecord(std::string& out, const STORAGE_SEARCH_RESULT& entry)
+{
+    return appendBinRecord(out, entry, entry.fileSize);
+}
+
+/**
+ * @brief Formats entries of a listing into stdout writer
+ *
+ * Formatting is done by hand into a reused buffer - no iostreams, and no flushing per entry.
+ */
+class ListingWriter {
+    StdoutWriter& m_writer;
+    ListFormat m_format;
+    bool m_details;
+    std::string m_line;
+
+    void appendText(const STORAGE_SEARCH_RESULT& entry);
+    void appendTsv(const STORAGE_SEARCH_RESULT& entry);
+    void appendNdjson(const STORAGE_SEARCH_RESULT& entry, const char* status = NULL);
+    bool appendBin(const STORAGE_SEARCH_RESULT& entry);
+    void appendSummary(const DirectorySummary& summary);
+
+public:
+    ListingWriter(StdoutWriter& writer, ListFormat format, bool details);
+
+    void write(const STORAGE_SEARCH_RESULT& entry);
+    void write(const DirectorySummary& summary);
+    void write(const FileChange& change);
+};
+
+#endif // __LISTING_HPP__
@@ -0,0 +1,44 @@
+#ifndef __MD5_HPP__
+#define __MD5_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Incremental MD5 (RFC 1321) - CKey of a CASC file is the MD5 of its decoded content
+ */
+class Md5 {
+    uint32_t m_state[4];
+    uint64_t m_length = 0;
+    unsigned char m_block[64];
+
+    void transform(const unsigned char* block);
+
+public:
+    static const size_t DIGEST_SIZE = 16;
+
+    Md5();
+
+    void update(const void* data, size_t len);
+
+    /**
+     * @brief Finish hashing and write the digest to out
+     *
+     * @param out DIGEST_SIZE bytes
+     */
+    void finish(unsigned char* out);
+};
+
+/**
+ * @brief Compute MD5 of a file on the filesystem
+ *
+ * @param path
+ * @param digest [out] Md5::DIGEST_SIZE bytes
+ * @param buffer read buffer, reused between calls; its size determines the size of reads
+ * @return false if the file couldn't be opened or read
+ */
+bool md5File(const std::string& path, unsigned char* digest, std::vector<char>& buffer);
+
+#endif // __MD5_HPP__
@@ -0,0 +1,67 @@
+#ifndef __MEMREPORT_HPP__
+#define __MEMREPORT_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+
+/**
+ * @brief Memory used by the process, accounted per phase of its run (open, enumerate, filter, ...)
+ *
+ * Heap allocations made through operator new are counted by replaced global allocation functions,
+ * once enabled. Allocations made by C code with malloc (parts of CascLib) aren't seen by the counters,
+ * but still show in RSS. Peak RSS of a phase is precise on Linux, where the high water mark can be reset
+ * at the start of each phase - elsewhere it's the peak of the process up to the end of the phase.
+ */
+class MemoryReport {
+public:
+    struct Phase
+    {
+        std::string name;
+        double seconds = 0;
+        uint64_t allocCount = 0;
+        uint64_t allocBytes = 0;
+        uint64_t freeCount = 0;
+        uint64_t freeBytes = 0;
+        // heap allocated through operator new since enabled, still live when the phase ended
+        uint64_t liveBytes = 0;
+        uint64_t peakLiveBytes = 0;
+        uint64_t rss = 0;
+        uint64_t peakRss = 0;
+    };
+
+private:
+    std::vector<Phase> m_phases;
+    bool m_inPhase = false;
+    std::chrono::steady_clock::time_point m_phaseStart;
+    uint64_t m_startAllocCount = 0;
+    uint64_t m_startAllocBytes = 0;
+    uint64_t m_startFreeCount = 0;
+    uint64_t m_startFreeBytes = 0;
+
+public:
+    /**
+     * @brief Start counting allocations - has to be called before any threads are started
+     */
+    static void enable();
+    static bool isEnabled();
+
+    /**
+     * @brief End current phase (if any), and start a new one - no-op unless enabled
+     */
+    void beginPhase(const char* name);
+
+    void endPhase();
+
+    const std::vector<Phase>& getPhases() const { return m_phases; }
+
+    void writeText(std::ostream& out) const;
+    void writeJson(std::ostream& out) const;
+};
+
+extern MemoryReport memReport;
+
+#endif // __MEMREPORT_HPP__
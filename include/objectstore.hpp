@@ -0,0 +1,67 @@
+#ifndef __OBJECTSTORE_HPP__
+#define __OBJECTSTORE_HPP__
+
+#include <stddef.h>
+#include <string>
+#include <unordered_set>
+
+/**
+ * @brief Content addressed directory of extracted files, shared between extractions of different builds
+ *
+ * Each object is named after the CKey (lowercase hex) of its content and sharded into subdirectories
+ * by the first byte of the key - `<store>/ab/ab01..ef`. Objects are written under a temporary name
+ * and renamed once complete, so an object that exists is always whole. They're made read-only before
+ * that, as every file linked to them shares their content.
+ */
+class ObjectStore {
+    std::string m_path;
+    bool m_symlinks;
+    std::string m_tempSuffix;
+    // paths of objects queued for writing during this run - not necessarily on the disk yet
+    std::unordered_set<std::string> m_queued;
+    size_t m_added = 0;
+    size_t m_reused = 0;
+
+public:
+    /**
+     * @param path directory of the store, created if it doesn't exist
+     * @param symlinks materialize files as symbolic links rather than hardlinks
+     */
+    ObjectStore(const std::string& path, bool symlinks);
+
+    /**
+     * @brief Create the directory, and resolve its absolute path (targets of symbolic links)
+     *
+     * @return false on failure
+     */
+    bool open();
+
+    bool useSymlinks() const { return m_symlinks; }
+
+    std::string objectPath(const std::string& ckeyHex) const;
+
+    /**
+     * @brief Name under which the object is written before it's complete
+     */
+    std::string tempPath(const std::string& objectPath) const;
+
+    /**
+     * @brief Check if the object is present (or about to be), otherwise mark it as queued
+     *
+     * @param objectPath
+     * @return true if the object has to be written by the caller
+     */
+    bool acquire(const std::string& objectPath);
+
+    /**
+     * @brief Forget object acquired by the caller, which failed to be written - it'll be written again if needed
+     *
+     * @param objectPath
+     */
+    void discard(const std::string& objectPath);
+
+    size_t getAdded() const { return m_added; }
+    size_t getReused() const { return m_reused; }
+};
+
+#endif // __OBJECTSTORE_HPP__
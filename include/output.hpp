@@ -0,0 +1,72 @@
+#ifndef __OUTPUT_HPP__
+#define __OUTPUT_HPP__
+
+#include <stddef.h>
+
+/**
+ * @brief Writes a stream of data to stdout, using the fastest method available for what stdout is connected to
+ *
+ * Data is decoded straight into one of two large buffers, which are handed to the kernel once full:
+ * - pipes - buffers are spliced into the pipe with `vmsplice`, no copy involved,
+ *   falls back to plain `write` if it isn't supported,
+ * - anything else (files, ttys) - buffered `write`.
+ *
+ * With `vmsplice` pages are only referenced by the pipe, they must stay untouched until the reader consumes them.
+ * Each buffer is at least as big as the pipe itself - once one buffer has been spliced entirely,
+ * no page of the other one can still be in the pipe, and it's safe to be filled again.
+ */
+class StdoutWriter {
+    enum class Mode {
+        Vmsplice,
+        Write,
+        Stdio,
+    };
+
+    Mode m_mode;
+    int m_fd;
+    char* m_buffers[2];
+    size_t m_bufferSize = 0;
+    size_t m_current = 0;
+    size_t m_used = 0;
+    bool m_failed = false;
+
+    bool emit(const char* data, size_t len, bool splice);
+
+public:
+    StdoutWriter();
+    ~StdoutWriter();
+
+    /**
+     * @brief Free space in the current buffer, to be filled by the caller and then passed to commit()
+     *
+     * @param available [out] number of bytes that can be written
+     * @return char*
+     */
+    char* reserve(size_t& available);
+
+    /**
+     * @brief Mark bytes previously obtained with reserve() as filled, hands the buffer over once it's full
+     *
+     * @param len
+     * @return false if writing has failed
+     */
+    bool commit(size_t len);
+
+    /**
+     * @brief Copy data into the buffers
+     *
+     * @param data
+     * @param len
+     * @return false if writing has failed
+     */
+    bool write(const void* data, size_t len);
+
+    /**
+     * @brief Hand over whatever remains in the current buffer
+     *
+     * @return false if writing has failed
+     */
+    bool flush();
+};
+
+#endif // __OUTPUT_HPP__
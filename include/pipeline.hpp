@@ -0,0 +1,132 @@
+#ifndef __PIPELINE_HPP__
+#define __PIPELINE_HPP__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief Writes extracted files to the filesystem on a separate thread
+ *
+ * Decoding (CascLib) and writing alternate on the same thread otherwise, keeping either the CPU or the disk idle.
+ * Here the decoding thread fills buffers taken from a fixed pool and queues them along with open and close
+ * of the target files, while the writer thread performs them. The pool bounds the queue - once all buffers
+ * are in flight, the decoder waits for the writer to return one.
+ *
+ * The writer takes all operations queued at the time it wakes up and performs them as a single batch - buffers
+ * return to the pool as soon as each of them is written, so decoding continues while the batch is in progress.
+ * Operations are performed in order they were queued. Failures are logged by the writer thread
+ * and counted per file.
+ */
+class ExtractPipeline {
+public:
+    struct Buffer {
+        std::vector<char> data;
+        size_t length = 0;
+    };
+
+private:
+    enum class OpType {
+        Open,
+        Write,
+        Close,
+        Link,
+    };
+
+    struct Op {
+        OpType type;
+        std::string path;
+        // Close: name to rename the file to, Link: file to link to
+        std::string target;
+        Buffer* buffer;
+        // Close: make the file read-only, Link: symbolic link rather than hardlink
+        bool flag;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_opsQueued;
+    std::condition_variable m_opsDone;
+    std::deque<Op> m_ops;
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+    std::vector<Buffer*> m_freeBuffers;
+    size_t m_submitted = 0;
+    size_t m_completed = 0;
+    size_t m_failures = 0;
+    // rename targets of files which failed to be written or moved there
+    std::vector<std::string> m_failedRenames;
+    bool m_stopping = false;
+    std::thread m_writer;
+
+    void queue(Op op);
+    void run();
+
+public:
+    /**
+     * @param bufferCount maximum number of buffers in flight
+     * @param bufferSize
+     */
+    ExtractPipeline(size_t bufferCount = 16, size_t bufferSize = 512 * 1024);
+
+    /**
+     * @brief Finishes all queued operations
+     */
+    ~ExtractPipeline();
+
+    /**
+     * @brief Take a free buffer from the pool, waiting for the writer if there's none
+     *
+     * @return Buffer* to be passed to write() or release()
+     */
+    Buffer* acquire();
+
+    /**
+     * @brief Return a buffer to the pool without writing it
+     */
+    void release(Buffer* buffer);
+
+    /**
+     * @brief Queue creation of the file (and directories leading to it), subsequent writes go to this file
+     */
+    void open(const std::string& path);
+
+    /**
+     * @brief Queue write of buffer->length bytes, the buffer returns to the pool once written
+     */
+    void write(Buffer* buffer);
+
+    /**
+     * @brief Queue close of the file opened last
+     *
+     * @param renameTo if not empty, the file is moved there once complete (removed in case of failure)
+     * @param readOnly drop write permissions of the file before moving it
+     */
+    void close(const std::string& renameTo = std::string(), bool readOnly = false);
+
+    /**
+     * @brief Queue creation of a link at path (and directories leading to it), pointing to target - replaces existing file
+     *
+     * @param target
+     * @param path
+     * @param symbolic symbolic link rather than hardlink
+     */
+    void link(const std::string& target, const std::string& path, bool symbolic);
+
+    /**
+     * @brief Wait until all queued operations are performed
+     *
+     * @return size_t number of files that failed to be written so far
+     */
+    size_t drain();
+
+    /**
+     * @brief Rename targets of files that failed since the last call - they don't exist
+     */
+    std::vector<std::string> takeFailedRenames();
+};
+
+#endif // __PIPELINE_HPP__
@@ -0,0 +1,92 @@
+#ifndef __SERVER_HPP__
+#define __SERVER_HPP__
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "storage.hpp"
+
+/**
+ * @brief Keeps storage and its enumerated index resident, answering requests of clients over a Unix socket
+ *
+ * Every message, in both directions, starts with a header: `u8 code | u32 payload length`, integers are little-endian.
+ * Requests can be pipelined - they're answered in order, each connection is served by its own thread.
+ * Protocol is described in detail in README.
+ */
+class StorageServer {
+public:
+    enum Request : uint8_t {
+        // payload: substring to search for (case insensitive), empty to list everything
+        REQ_LIST = 1,
+        // payload: sequence of `u16 length | name`
+        REQ_STAT = 2,
+        // payload: `u64 offset | u64 length | name`
+        REQ_READ = 3,
+        // payload: `u16 length | name | target path` - relative to the extraction directory of the server
+        REQ_EXTRACT = 4,
+    };
+
+    enum Status : uint8_t {
+        STATUS_OK = 0,
+        // more frames of the same response follow
+        STATUS_PARTIAL = 1,
+        STATUS_NOT_FOUND = 2,
+        STATUS_BAD_REQUEST = 3,
+        STATUS_IO_ERROR = 4,
+    };
+
+    /**
+     * @param explorer
+     * @param entries
+     * @param extractRoot directory that targets of extract requests are confined to
+     */
+    StorageServer(StorageExplorer& explorer, const std::vector<STORAGE_SEARCH_RESULT*>& entries, const std::string& extractRoot);
+
+    /**
+     * @brief Listen on given socket path, until interrupted
+     *
+     * @param socketPath
+     * @return non zero in case of failure
+     */
+    int serve(const std::string& socketPath);
+
+private:
+    struct ClientConnection
+    {
+        // closed only by the thread accepting connections, after the client thread has been joined
+        int fd;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+
+    StorageExplorer& m_explorer;
+    const std::vector<STORAGE_SEARCH_RESULT*>& m_entries;
+    std::string m_extractRoot;
+    // lowercased names with backslashes as separators
+    std::unordered_map<std::string, STORAGE_SEARCH_RESULT*> m_index;
+    // CascLib isn't guaranteed to be safe to use from multiple threads at once
+    std::mutex m_storageMutex;
+    std::list<ClientConnection> m_clients;
+
+    STORAGE_SEARCH_RESULT* findEntry(const std::string& name);
+
+    /**
+     * @brief Path of extract request target within m_extractRoot
+     *
+     * @return false if it's absolute or leads out of it
+     */
+    bool resolveTarget(const std::string& target, std::string& targetFilename);
+
+    void reapClients(bool all);
+    void handleClient(int fd);
+    bool handleList(int fd, const std::string& payload);
+    bool handleStat(int fd, const std::string& payload);
+    bool handleRead(int fd, const std::string& payload);
+    bool handleExtract(int fd, const std::string& payload);
+};
+
+#endif // __SERVER_HPP__
@@ -0,0 +1,72 @@
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Lock-free latency histogram, with power-of-two buckets of nanoseconds
+ *
+ * Recording is a single relaxed atomic increment, cheap enough to keep enabled at all times.
+ */
+class LatencyHistogram {
+public:
+    static const size_t BUCKET_COUNT = 48;
+
+    LatencyHistogram();
+
+    void Record(uint64_t ns);
+
+    uint64_t Count() const;
+
+    /**
+     * @brief Upper bound (in nanoseconds) of the bucket holding given percentile
+     *
+     * @param p in range of [0, 1]
+     * @return uint64_t 0 if nothing has been recorded yet
+     */
+    uint64_t Percentile(double p) const;
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+};
+
+/**
+ * @brief Counters of a single operation
+ */
+struct OpStats
+{
+    std::atomic<uint64_t> errors{0};
+    LatencyHistogram latency;
+
+    /// Count an error and pass its code through
+    int Error(int code)
+    {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        return code;
+    }
+};
+
+/**
+ * @brief Records time elapsed between its construction and destruction into the histogram
+ */
+class ScopedLatency {
+    LatencyHistogram& m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    ScopedLatency(LatencyHistogram& histogram)
+        : m_histogram(histogram), m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedLatency()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        m_histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+};
+
+#endif // __STATS_HPP__
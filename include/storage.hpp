@@ -2,6 +2,7 @@
 #define __STORAGE_HPP__
 
 #include <iostream>
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -10,6 +11,10 @@
 #include "../CascLib/src/CascLib.h"
 #include "common.hpp"
 #include "util.hpp"
+#include "output.hpp"
+#include "md5.hpp"
+#include "pipeline.hpp"
+#include "objectstore.hpp"
 
 // Based on CASC_FIND_DATA
 struct STORAGE_SEARCH_RESULT
@@ -30,6 +35,10 @@ struct STORAGE_SEARCH_RESULT
     // If true the file is available locally
     DWORD fileAvailable:1;
 
+    // If true the file is opened by its CKey (or EKey), rather than by resolving the name
+    DWORD hasCKey:1;
+    DWORD hasEKey:1;
+
     // Name type in 'szFileName'. In case the file name is not known,
     // CascLib can put FileDataId-like name or a string representation of CKey/EKey
     CASC_NAME_TYPE nameType;
@@ -41,10 +50,58 @@ struct STORAGE_SEARCH_RESULT
 class StorageExplorer {
 protected:
     HANDLE m_hStorage = nullptr;
+    bool m_verify = false;
+    size_t m_verifyFailures = 0;
+    uint64_t m_rangeOffset = 0;
+    uint64_t m_rangeLength = UINT64_MAX;
+
+    /**
+     * @brief Move to the start of the range set with setRange()
+     *
+     * @return uint64_t number of bytes to extract from there
+     */
+    uint64_t seekRange(HANDLE hFile);
+
+    /**
+     * @brief Compare the MD5 of extracted data with CKey of the opened file
+     *
+     * @return false on mismatch (which is also logged and counted)
+     */
+    bool verifyContentKey(HANDLE hFile, Md5& md5, const std::string& storedFilename);
+
+    /**
+     * @brief Decode up to length bytes of the opened file into the writer's buffers
+     *
+     * @return size_t number of bytes decoded
+     */
+    size_t decodeToWriter(HANDLE hFile, uint64_t length, StdoutWriter& writer, Md5& md5);
 
 public:
     HANDLE getHandle() { return m_hStorage; }
 
+    /**
+     * @brief Open file of the entry - by its CKey or EKey if known, otherwise by name
+     */
+    bool openFile(const STORAGE_SEARCH_RESULT& entry, HANDLE* hFile);
+
+    /**
+     * @brief Hash data while extracting it, and compare the digest with CKey of the file
+     */
+    void setVerify(bool verify) { m_verify = verify; }
+
+    /**
+     * @brief Limit extraction to a part of each file - only frames covering it are decoded
+     *
+     * @param offset
+     * @param length UINT64_MAX for the rest of the file
+     */
+    void setRange(uint64_t offset, uint64_t length) { m_rangeOffset = offset; m_rangeLength = length; }
+
+    /**
+     * @brief Number of files extracted with setVerify() on, that didn't match their CKey
+     */
+    size_t getVerifyFailures() const { return m_verifyFailures; }
+
     ~StorageExplorer();
 
     /**
@@ -65,25 +122,91 @@ public:
 
     // TODO: CascGetStorageInfo
 
-    bool enumerateFiles(std::vector<STORAGE_SEARCH_RESULT*>& searchResults);
+    /**
+     * @brief Enumerate files available locally
+     *
+     * @param searchResults
+     * @param mask wildcard mask evaluated by CascLib - files not matching it are skipped before any record is created
+     * @return false on failure
+     */
+    bool enumerateFiles(std::vector<STORAGE_SEARCH_RESULT*>& searchResults, const std::string& mask = "*");
 
     /**
      * @brief extract data of given file to location specified under filesystem
      *
-     * @param storedFilename
+     * @param entry
      * @param targetFilename
      * @return size_t
      */
-    size_t extractFileToPath(const std::string& storedFilename, const std::string& targetFilename);
+    size_t extractFileToPath(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename);
+
+    /**
+     * @brief extract data of given file to location specified under filesystem, writing it through the pipeline
+     *
+     * Data is decoded on the calling thread, creating and writing the file is left to the pipeline.
+     * Write errors are reported by the pipeline.
+     *
+     * @param entry
+     * @param targetFilename
+     * @param pipeline
+     * @return size_t decoded size
+     */
+    size_t extractFileToPath(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename, ExtractPipeline& pipeline);
+
+    /**
+     * @brief materialize given file at location specified under filesystem as a link into the object store
+     *
+     * Content is decoded into the store only if an object of its CKey isn't there yet.
+     *
+     * @param entry
+     * @param targetFilename
+     * @param store
+     * @param pipeline
+     * @return size_t decoded size - zero if the object was already present
+     */
+    size_t extractFileToStore(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename, ObjectStore& store, ExtractPipeline& pipeline);
+
+    /**
+     * @brief extract data of given file to location specified under filesystem, decoding it straight into a memory mapping of the target
+     *
+     * Target is sized upfront and mapped, skipping the copy through an intermediate buffer and write().
+     * Falls back to extractFileToPath() if the file cannot be mapped (or on platforms without mmap).
+     *
+     * @param entry
+     * @param targetFilename
+     * @return size_t
+     */
+    size_t extractFileToMapping(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename);
 
     /**
      * @brief extract data of given file and write it to a FILE stream (not limited to files)
      *
-     * @param storedFilename
+     * @param entry
      * @param outStream
      * @return size_t
      */
-    size_t extractFileData(const std::string& storedFilename, FILE* outStream);
+    size_t extractFileData(const STORAGE_SEARCH_RESULT& entry, FILE* outStream);
+
+    /**
+     * @brief extract data of given file to stdout, decoding it directly into the writer's buffers
+     *
+     * @param entry
+     * @param writer
+     * @return size_t
+     */
+    size_t extractFileData(const STORAGE_SEARCH_RESULT& entry, StdoutWriter& writer);
+
+    /**
+     * @brief extract data of given file to stdout as a self-delimiting record
+     *
+     * Record is the same as in `--format bin` listing (name, CKey, EKey, size), followed by size bytes of the content.
+     * Should decoding stop short, payload is padded with zeros to the announced size.
+     *
+     * @param entry
+     * @param writer
+     * @return size_t number of bytes decoded
+     */
+    size_t extractFileFramed(const STORAGE_SEARCH_RESULT& entry, StdoutWriter& writer);
 };
 
 #endif // __STORAGE_HPP__
@@ -0,0 +1,53 @@
+#ifndef __THROTTLE_HPP__
+#define __THROTTLE_HPP__
+
+#include <stdint.h>
+#include <mutex>
+#include <chrono>
+
+/**
+ * @brief Limits throughput of all threads sharing it to a given rate of bytes per second
+ *
+ * Callers take tokens after each transfer, going into debt if there aren't enough of them,
+ * and sleep until the debt would be paid off - so large transfers don't have to be split.
+ * Up to a fraction of a second worth (and at least a couple of MiB) of unused tokens is kept for bursts.
+ */
+class TokenBucket {
+    std::mutex m_mutex;
+    // 0 means unlimited - set before any threads are started, not synchronized otherwise
+    double m_rate = 0;
+    double m_capacity = 0;
+    double m_tokens = 0;
+    std::chrono::steady_clock::time_point m_lastRefill;
+
+public:
+    void setRate(uint64_t bytesPerSecond);
+
+    bool isLimited() const { return m_rate > 0; }
+
+    /**
+     * @brief Account transferred bytes, blocking the caller for as long as the rate requires
+     */
+    void consume(uint64_t bytes)
+    {
+        if (m_rate > 0) consumeLimited(bytes);
+    }
+
+private:
+    void consumeLimited(uint64_t bytes);
+};
+
+/**
+ * @brief Bandwidth limits shared by extraction, the mount and the server
+ */
+struct IoThrottle
+{
+    // data decoded from the storage
+    TokenBucket read;
+    // data written to files or stdout
+    TokenBucket write;
+};
+
+extern IoThrottle ioThrottle;
+
+#endif // __THROTTLE_HPP__
@@ -2,6 +2,9 @@
 #define __UTIL_HPP__
 
 #include <dirent.h>
+#include <string>
+#include <vector>
+#include <regex>
 
 #if (defined(_WIN32) || defined(_WIN64))
     #include <direct.h>
@@ -19,12 +22,38 @@ bool pathExists(const std::string& target);
 int ensureDirExists(std::string strDestName);
 
 std::string formatFileSize(size_t size);
+/// Same as formatFileSize(size_t), written into out (NUL terminated) - returns length of the result
+size_t formatFileSize(char *out, size_t size);
 
 /// Try to find in the Haystack the Needle - ignore case
 bool stringFindIC(const std::string& strHaystack, const std::string& strNeedle);
 bool stringEqualIC(const std::string& str1, const std::string& str2);
+/// Check if filename matches any of the patterns
+bool searchRegexMulti(const std::string& filename, const std::vector<std::regex>& patterns);
+/// Check if path lies under directory prefix (or is the prefix itself) - ignore case, separators ('/', '\\', ':') are equivalent
+bool pathHasPrefix(const std::string& path, const std::string& prefix);
+/// Match whole path against glob pattern - ignore case, separators ('/', '\\', ':') are equivalent
+/// '?' matches single char, '*' any sequence within a path component, '**' any sequence including separators
+bool globMatch(const std::string& pattern, const std::string& path);
+/// Part of glob pattern preceding its first wildcard
+std::string globLiteralPrefix(const std::string& pattern);
 void stringToLower(std::string& str);
 std::string stringToLowerCopy(std::string str);
+enum class SchedPriority {
+    Normal,
+    // lowest priority within the regular scheduling classes
+    Low,
+    // runs only when nothing else wants the CPU or the disk
+    Idle,
+};
+
+/// Set CPU and I/O scheduling priority of the calling thread - threads started by it afterwards inherit it
+/// Returns false if the platform refused (or doesn't support) any part of it
+bool setThreadPriority(SchedPriority priority);
 void formatBytes(std::ostream& out, const unsigned char *data, size_t dataLen, bool format = true);
+/// Write lowercase hex representation of data to out, followed by NUL - out must fit (dataLen * 2 + 1) chars
+void bytesToHex(char *out, const unsigned char *data, size_t dataLen);
+/// Parse NUL terminated hex string of exactly (dataLen * 2) digits into out - returns false if it isn't one
+bool hexToBytes(unsigned char *out, const char *hex, size_t dataLen);
 
 #endif // __UTIL_HPP__
@@ -10,326 +10,295 @@
 #include <unordered_map>
 #include <map>
 #include <cctype>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <numeric>
+#include <chrono>
 
 #define __CASCLIB_SELF__
 #include "../CascLib/src/CascLib.h"
 #include "../CascLib/src/CascCommon.h"
 #include "common.hpp"
 #include "util.hpp"
+#include "cascfuse.hpp"
+#include "stats.hpp"
+#include "fstree.hpp"
+#include "memreport.hpp"
+#include "throttle.hpp"
 
 #ifndef WIN32
     #define FUSE_STAT struct stat
     #define FUSE_OFF_T off_t
 #endif
 
-enum class FsNodeKind {
-    Unknown,
-    Root,
-    Folder,
-    File,
-};
-
-class StringIHasher
+struct CascfsStats
 {
-public:
-    size_t operator()(const std::string& k) const
-    {
-        std::string str = k;
-        std::transform(str.begin(), str.end(), str.begin(), [](const char& ch) {
-            switch (ch) {
-                case '\\': return '/';
-                default: return static_cast<char>(::tolower(ch));
-            }
-        });
-        return CalcNormNameHash(str.c_str(), str.size());
-    }
+    OpStats getattr;
+    OpStats readdir;
+    OpStats open;
+    OpStats read;
+    OpStats getxattr;
+    OpStats listxattr;
+
+    LatencyHistogram cascReadFile;
+    std::atomic<uint64_t> bytesRead{0};
+
+    // background warm-up
+    size_t warmTotal = 0;
+    std::atomic<uint64_t> warmFiles{0};
+    std::atomic<uint64_t> warmBytes{0};
+
+    // estimated at the time the tree was built
+    size_t treeMemory = 0;
+    size_t nodeCount = 0;
 };
 
-class StringIComparator
-{
-public:
-    bool operator()(const std::string& str1, const std::string& str2) const
-    {
-        return str1.size() == str2.size() && std::equal(str1.begin(), str1.end(), str2.begin(), [](const char& ch1, const char& ch2) {
-            if ((ch1 == '/' || ch1 == '\\') && (ch2 == '/' || ch2 == '\\')) {
-                return true;
-            }
-            else {
-                return std::tolower(ch1) == std::tolower(ch2);
-            }
-        });
-    }
-};
-
-class FsNode {
-    std::string m_name;
-    std::string m_filename;
-    FsNode* m_parent = NULL;
-    std::unordered_map<std::string, FsNode*, StringIHasher, StringIComparator> m_children;
-public:
-    const FsNodeKind m_kind = FsNodeKind::Unknown;
-    PCASC_CKEY_ENTRY ckeyEntry = NULL;
-
-    FsNode(FsNodeKind nKind, std::string name, FsNode *parent)
-        : m_kind(nKind), m_name(name), m_parent(parent)
-    {
-    }
-
-    FsNode(FsNodeKind nKind = FsNodeKind::Root)
-        : m_kind(nKind), m_name("/")
-    {
-    }
-
-    void Insert(FsNode* childNode)
-    {
-        assert(m_kind != FsNodeKind::File);
-        m_children[stringToLowerCopy(childNode->Name())] = childNode;
-    }
+CascfsStats cfStats;
 
-    FsNode *Insert(FsNodeKind nKind, const std::string& name)
-    {
-        auto childNode = new FsNode(nKind, name, this);
-        Insert(childNode);
-        return childNode;
-    }
+FsTree cfFileTree;
 
-    const std::unordered_map<std::string, FsNode*, StringIHasher, StringIComparator>& Children()
-    {
-        return m_children;
-    }
+// time of the last open or read served - warm-up backs off while the mount is in use
+static std::atomic<int64_t> cfLastForeground{0};
 
-    const std::string& Name()
-    {
-        return m_name;
-    }
+// CascLib isn't guaranteed to be safe to use from multiple threads at once - held around every call
+// made after the tree is built, by the FUSE thread as well as the warm-up workers
+static std::mutex cfStorageMutex;
 
-    FsNode* Parent()
-    {
-        return m_parent;
-    }
+static inline int64_t cascfs_now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-    void SetParent(FsNode* newParent)
-    {
-        m_parent = newParent;
-    }
+static int cascfs_fillstat(FsNode* fNode, FUSE_STAT *stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_ino = fNode->inode;
 
-    const std::string Filepath()
-    {
-        if (m_filename.length()) return m_filename;
-
-        std::vector<const FsNode*> parentNodes;
-        auto currParent = this;
-        do {
-            parentNodes.push_back(currParent);
-            currParent = currParent->Parent();
-        } while (currParent != NULL && (currParent->m_kind == FsNodeKind::Folder || currParent->m_kind == FsNodeKind::File));
-
-        std::ostringstream osPath;
-        for (auto it = parentNodes.rbegin(); it != parentNodes.rend(); it++) {
-            if ((*it)->m_kind == FsNodeKind::Root) {
-                osPath << (*it)->m_name;
-            }
-            else {
-                osPath << '/' << (*it)->m_name;
-            }
+    switch (fNode->m_kind) {
+        case FsNodeKind::Root:
+        case FsNodeKind::Folder:
+        {
+            stbuf->st_mode = S_IFDIR | 0554;
+            stbuf->st_nlink = 2;
+            stbuf->st_size = 0;
+            return 0;
         }
-        m_filename = osPath.str();
-
-        return m_filename;
-    }
-};
 
-class FsTree {
-    const size_t m_openFileLimit = 128;
-    FsNode m_rootNode;
-    std::unordered_map<std::string, FsNode*, StringIHasher, StringIComparator> m_nodeMap;
-    std::map<std::string, HANDLE> m_openFiles;
-
-public:
-    FsNode* GetRootNode() { return &m_rootNode; }
-    std::unordered_map<std::string, FsNode*, StringIHasher, StringIComparator>& GetNodeMap() { return m_nodeMap; }
-    HANDLE m_hStorage = NULL;
-
-    FsTree()
-        : m_rootNode(FsNodeKind::Root)
-    {
-    }
-
-    void GenerateNodeHashMap(FsNode* fNode)
-    {
-        if (fNode->m_kind != FsNodeKind::Unknown) {
-            m_nodeMap[fNode->Filepath()] = fNode;
-        }
+        case FsNodeKind::File:
+        {
+            stbuf->st_mode = S_IFREG | 0554;
+            stbuf->st_nlink = fNode->content->nlink;
 
-        for (auto childNode : fNode->Children()) {
-            GenerateNodeHashMap(childNode.second);
+            stbuf->st_size = fNode->content->ckeyEntry->ContentSize;
+            return 0;
         }
-    }
 
-    FsNode* GetNodeAtPath(const char* path)
-    {
-        auto fNode = m_nodeMap.find(path);
-        if (fNode != m_nodeMap.end()) {
-            return fNode->second;
+        case FsNodeKind::Control:
+        {
+            // generated upon open, size isn't known upfront - opened with direct_io
+            stbuf->st_mode = S_IFREG | 0444;
+            stbuf->st_nlink = 1;
+            stbuf->st_size = 0;
+            return 0;
         }
-        return NULL;
-    }
 
-    FsNode* GetParentNodeOfFilename(const std::string& filename)
-    {
-        size_t pos_start = 0;
-        size_t pos_end = std::string::npos;
-        auto currentNode = GetRootNode();
-
-        while ((pos_end = filename.find_first_of(":\\", pos_start)) != std::string::npos) {
-            std::string dirname = filename.substr(pos_start, pos_end - pos_start);
-            pos_start = pos_end + 1;
-            auto folderNodeEntry = currentNode->Children().find(dirname);
-            if (folderNodeEntry != currentNode->Children().end()) {
-                currentNode = folderNodeEntry->second;
-            }
-            else {
-                currentNode = currentNode->Insert(FsNodeKind::Folder, dirname);
-            }
+        default:
+        {
+            return -ENOENT;
         }
-
-        return currentNode;
     }
+}
 
-    HANDLE GetNodeHandle(FsNode* fNode)
-    {
-        auto result = m_openFiles.find(fNode->Filepath());
-        if (result != m_openFiles.end()) {
-            return result->second;
-        }
-        else {
-            if (m_openFiles.size() >= m_openFileLimit) {
-                LOG_DEBUG << "Open files limit reached (" << m_openFileLimit << "). Closing first half..";
-                for (auto it = m_openFiles.cbegin(); it != m_openFiles.end();) {
-                    if (m_openFiles.size() > m_openFileLimit / 2) {
-                        LOG_VERBOSE << "Closing: " << it->first;
-                        CascCloseFile(it->second);
-                        it = m_openFiles.erase(it);
-                    }
-                    else {
-                        // ++it;
-                        break;
-                    }
-                }
-            }
-
-            HANDLE hFile;
-            if (!CascOpenFile(m_hStorage, fNode->ckeyEntry->CKey, CASC_LOCALE_ALL, CASC_OPEN_BY_CKEY, &hFile)) {
-                LOG_ERROR << "Couldn't open file " << fNode->Filepath();
-                return NULL;
-            }
-            m_openFiles[fNode->Filepath()] = hFile;
+static int cascfs_getattr(const char *path, FUSE_STAT *stbuf)
+{
+    LOG_VERBOSE << path;
+    ScopedLatency opLatency(cfStats.getattr.latency);
 
-            return hFile;
-        }
+    auto fNode = cfFileTree.GetNodeAtPath(path);
+    if (fNode == NULL) {
+        memset(stbuf, 0, sizeof(*stbuf));
+        return cfStats.getattr.Error(-ENOENT);
     }
-};
 
-FsTree cfFileTree;
+    return cascfs_fillstat(fNode, stbuf);
+}
 
-static int cascfs_getattr(const char *path, FUSE_STAT *stbuf)
+static int cascfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, FUSE_OFF_T offset, struct fuse_file_info *fi)
 {
-    LOG_VERBOSE << path;
-    int res = 0;
-    memset(stbuf, 0, sizeof(*stbuf));
+    LOG_VERBOSE << path << " at " << offset;
+    ScopedLatency opLatency(cfStats.readdir.latency);
 
     auto fNode = cfFileTree.GetNodeAtPath(path);
-    if (fNode != NULL) {
-        switch (fNode->m_kind) {
-            case FsNodeKind::Root:
-            case FsNodeKind::Folder:
-            {
-                stbuf->st_mode = S_IFDIR | 0554;
-                stbuf->st_nlink = 2;
-                stbuf->st_size = 0;
-                break;
-            }
+    if (fNode == NULL || (fNode->m_kind != FsNodeKind::Root && fNode->m_kind != FsNodeKind::Folder)) {
+        return cfStats.readdir.Error(-ENOENT);
+    }
 
-            case FsNodeKind::File:
-            {
-                stbuf->st_mode = S_IFREG | 0554;
-                stbuf->st_nlink = 1;
+    // Entries are passed along with their offsets, so FUSE can hand us back the offset of the last
+    // entry that fit in its buffer, and continue from there. Offsets 1 and 2 are taken by "." and "..".
+    if (offset < 1 && filler(buf, ".", NULL, 1)) return 0;
+    if (offset < 2 && filler(buf, "..", NULL, 2)) return 0;
+
+    // provide attributes upfront, sparing the kernel a getattr for each entry
+    FUSE_STAT stbuf;
+    const auto& entries = fNode->Entries();
+    for (size_t i = offset > 2 ? offset - 2 : 0; i < entries.size(); ++i) {
+        cascfs_fillstat(entries[i], &stbuf);
+        if (filler(buf, entries[i]->Name().c_str(), &stbuf, i + 3)) break;
+    }
 
-                stbuf->st_size = fNode->ckeyEntry->ContentSize;
-                break;
-            }
+    return 0;
+}
 
-            default:
-            {
-                res = -ENOENT;
-                break;
-            }
-        }
-    }
-    else {
-        res = -ENOENT;
+static std::string cascfs_formatstats()
+{
+    std::string out;
+    char line[256];
+
+    snprintf(line, sizeof(line), "%-12s %12s %10s %12s %12s\n", "op", "count", "errors", "p50 (us)", "p99 (us)");
+    out += line;
+
+    const std::pair<const char*, const OpStats*> ops[] = {
+        { "getattr", &cfStats.getattr },
+        { "readdir", &cfStats.readdir },
+        { "open", &cfStats.open },
+        { "read", &cfStats.read },
+        { "getxattr", &cfStats.getxattr },
+        { "listxattr", &cfStats.listxattr },
+    };
+    for (const auto& op : ops) {
+        const auto& latency = op.second->latency;
+        snprintf(line, sizeof(line), "%-12s %12llu %10llu %12.1f %12.1f\n",
+            op.first,
+            static_cast<unsigned long long>(latency.Count()),
+            static_cast<unsigned long long>(op.second->errors.load(std::memory_order_relaxed)),
+            latency.Percentile(0.50) / 1000.0,
+            latency.Percentile(0.99) / 1000.0
+        );
+        out += line;
     }
 
-    return res;
+    snprintf(line, sizeof(line), "%-12s %12llu %10s %12.1f %12.1f\n\n",
+        "CascReadFile",
+        static_cast<unsigned long long>(cfStats.cascReadFile.Count()),
+        "-",
+        cfStats.cascReadFile.Percentile(0.50) / 1000.0,
+        cfStats.cascReadFile.Percentile(0.99) / 1000.0
+    );
+    out += line;
+
+    uint64_t handleHits = cfFileTree.GetHandleHits();
+    uint64_t handleMisses = cfFileTree.GetHandleMisses();
+    uint64_t handleTotal = handleHits + handleMisses;
+    snprintf(line, sizeof(line),
+        "bytes_read %llu\n"
+        "handle_hits %llu\n"
+        "handle_misses %llu\n"
+        "handle_hit_ratio %.4f\n"
+        "tree_nodes %llu\n"
+        "tree_contents %llu\n"
+        "tree_memory %llu\n"
+        "warm_total %llu\n"
+        "warm_files %llu\n"
+        "warm_bytes %llu\n",
+        static_cast<unsigned long long>(cfStats.bytesRead.load(std::memory_order_relaxed)),
+        static_cast<unsigned long long>(handleHits),
+        static_cast<unsigned long long>(handleMisses),
+        handleTotal ? static_cast<double>(handleHits) / handleTotal : 0.0,
+        static_cast<unsigned long long>(cfStats.nodeCount),
+        static_cast<unsigned long long>(cfFileTree.GetContentCount()),
+        static_cast<unsigned long long>(cfStats.treeMemory),
+        static_cast<unsigned long long>(cfStats.warmTotal),
+        static_cast<unsigned long long>(cfStats.warmFiles.load(std::memory_order_relaxed)),
+        static_cast<unsigned long long>(cfStats.warmBytes.load(std::memory_order_relaxed))
+    );
+    out += line;
+
+    return out;
 }
 
-static int cascfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, FUSE_OFF_T offset, struct fuse_file_info *fi)
+static int cascfs_open(const char *path, struct fuse_file_info *fi)
 {
     LOG_VERBOSE << path;
+    ScopedLatency opLatency(cfStats.open.latency);
+    cfLastForeground.store(cascfs_now(), std::memory_order_relaxed);
 
     auto fNode = cfFileTree.GetNodeAtPath(path);
-    if (fNode == NULL || fNode->m_kind == FsNodeKind::File) {
-        return -ENOENT;
+    if (fNode == NULL || (fNode->m_kind != FsNodeKind::File && fNode->m_kind != FsNodeKind::Control)) {
+        return cfStats.open.Error(-ENOENT);
     }
 
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
+    if((fi->flags & 3) != O_RDONLY)
+        return cfStats.open.Error(-EACCES);
 
-    for (auto childNode : fNode->Children()) {
-        filler(buf, childNode.second->Name().c_str(), NULL, 0);
+    if (fNode->m_kind == FsNodeKind::Control) {
+        // snapshot taken at the time of opening, served until released
+        fi->fh = reinterpret_cast<uint64_t>(new std::string(cascfs_formatstats()));
+        fi->direct_io = 1;
     }
 
     return 0;
 }
 
-static int cascfs_open(const char *path, struct fuse_file_info *fi)
+static int cascfs_release(const char *path, struct fuse_file_info *fi)
 {
     LOG_VERBOSE << path;
 
-    auto fNode = cfFileTree.GetNodeAtPath(path);
-    if (fNode == NULL || fNode->m_kind != FsNodeKind::File) {
-        return -ENOENT;
+    if (fi->fh != 0) {
+        delete reinterpret_cast<std::string*>(fi->fh);
+        fi->fh = 0;
     }
 
-    if((fi->flags & 3) != O_RDONLY)
-        return -EACCES;
-
     return 0;
 }
 
 static int cascfs_read(const char *path, char *buf, size_t size, FUSE_OFF_T offset, struct fuse_file_info *fi)
 {
     LOG_VERBOSE << path << " at " << offset << " size " << size;
+    ScopedLatency opLatency(cfStats.read.latency);
+    cfLastForeground.store(cascfs_now(), std::memory_order_relaxed);
 
     auto fNode = cfFileTree.GetNodeAtPath(path);
     if (fNode == NULL) {
-        return -ENOENT;
+        return cfStats.read.Error(-ENOENT);
     }
 
     switch (fNode->m_kind) {
         case FsNodeKind::File:
         {
             DWORD readLen;
-            auto fHandle = cfFileTree.GetNodeHandle(fNode);
-            if (fHandle == NULL) {
-                LOG_ERROR << "Failed to open " << fNode->Filepath() << " E" << GetLastError();
-                return 0;
+            bool readResult;
+            {
+                std::lock_guard<std::mutex> lock(cfStorageMutex);
+                auto fHandle = cfFileTree.GetNodeHandle(fNode);
+                if (fHandle == NULL) {
+                    LOG_ERROR << "Failed to open " << fNode->Filepath() << " E" << GetLastError();
+                    return cfStats.read.Error(0);
+                }
+                CascSetFilePointer(fHandle, offset, NULL, FILE_BEGIN);
+                ScopedLatency readLatency(cfStats.cascReadFile);
+                readResult = CascReadFile(fHandle, buf, size, &readLen);
+                if (!readResult) {
+                    LOG_ERROR << "Failed to read " << fNode->Filepath() << " E" << GetLastError();
+                }
             }
-            CascSetFilePointer(fHandle, offset, NULL, FILE_BEGIN);
-            if (!CascReadFile(cfFileTree.GetNodeHandle(fNode), buf, size, &readLen)) {
-                LOG_ERROR << "Failed to read " << fNode->Filepath() << " E" << GetLastError();
+            if (!readResult) {
+                return cfStats.read.Error(0);
+            }
+            cfStats.bytesRead.fetch_add(readLen, std::memory_order_relaxed);
+            ioThrottle.read.consume(readLen);
+            return readLen;
+        }
+
+        case FsNodeKind::Control:
+        {
+            auto snapshot = reinterpret_cast<const std::string*>(fi->fh);
+            if (snapshot == NULL || static_cast<size_t>(offset) >= snapshot->size()) {
                 return 0;
             }
+            size_t readLen = std::min(size, snapshot->size() - static_cast<size_t>(offset));
+            memcpy(buf, snapshot->data() + offset, readLen);
             return readLen;
         }
 
@@ -340,12 +309,157 @@ static int cascfs_read(const char *path, char *buf, size_t size, FUSE_OFF_T offs
     }
 }
 
-void cascfs_populate(HANDLE hStorage)
+#ifndef WIN32
+
+#ifndef ENOATTR
+    #define ENOATTR ENODATA
+#endif
+
+// NUL separated, as expected by listxattr
+static const char cascfsXattrNames[] =
+    "user.casc.ckey\0"
+    "user.casc.ekey\0"
+    "user.casc.encoded_size\0"
+    "user.casc.compression_ratio\0";
+
+static bool cascfs_xattrvalue(FsContent* content, const char* name, std::string& value)
+{
+    auto ckeyEntry = content->ckeyEntry;
+    char buff[MD5_STRING_SIZE + 1];
+
+    if (strcmp(name, "user.casc.ckey") == 0) {
+        bytesToHex(buff, ckeyEntry->CKey, sizeof(ckeyEntry->CKey));
+        value = buff;
+    }
+    else if (strcmp(name, "user.casc.ekey") == 0) {
+        bytesToHex(buff, ckeyEntry->EKey, sizeof(ckeyEntry->EKey));
+        value = buff;
+    }
+    else if (strcmp(name, "user.casc.encoded_size") == 0) {
+        if (ckeyEntry->EncodedSize == CASC_INVALID_SIZE) return false;
+        value = std::to_string(ckeyEntry->EncodedSize);
+    }
+    else if (strcmp(name, "user.casc.compression_ratio") == 0) {
+        if (ckeyEntry->EncodedSize == CASC_INVALID_SIZE || ckeyEntry->ContentSize == 0) return false;
+        snprintf(buff, sizeof(buff), "%.4f", static_cast<double>(ckeyEntry->EncodedSize) / ckeyEntry->ContentSize);
+        value = buff;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef __APPLE__
+static int cascfs_getxattr(const char *path, const char *name, char *value, size_t size, uint32_t position)
+#else
+static int cascfs_getxattr(const char *path, const char *name, char *value, size_t size)
+#endif
+{
+    LOG_VERBOSE << path << " " << name;
+    ScopedLatency opLatency(cfStats.getxattr.latency);
+
+    auto fNode = cfFileTree.GetNodeAtPath(path);
+    if (fNode == NULL) {
+        return cfStats.getxattr.Error(-ENOENT);
+    }
+
+    std::string attrValue;
+    if (fNode->m_kind != FsNodeKind::File || !cascfs_xattrvalue(fNode->content, name, attrValue)) {
+        return cfStats.getxattr.Error(-ENOATTR);
+    }
+
+    if (size == 0) {
+        return attrValue.size();
+    }
+    if (size < attrValue.size()) {
+        return cfStats.getxattr.Error(-ERANGE);
+    }
+    memcpy(value, attrValue.data(), attrValue.size());
+
+    return attrValue.size();
+}
+
+static int cascfs_listxattr(const char *path, char *list, size_t size)
+{
+    LOG_VERBOSE << path;
+    ScopedLatency opLatency(cfStats.listxattr.latency);
+
+    auto fNode = cfFileTree.GetNodeAtPath(path);
+    if (fNode == NULL) {
+        return cfStats.listxattr.Error(-ENOENT);
+    }
+
+    if (fNode->m_kind != FsNodeKind::File) {
+        return 0;
+    }
+
+    // skip terminating NUL of the literal itself
+    const size_t namesLen = sizeof(cascfsXattrNames) - 1;
+    if (size == 0) {
+        return namesLen;
+    }
+    if (size < namesLen) {
+        return cfStats.listxattr.Error(-ERANGE);
+    }
+    memcpy(list, cascfsXattrNames, namesLen);
+
+    return namesLen;
+}
+
+#endif
+
+// subtrees below this depth are built concurrently, one subtree per worker at a time
+static const unsigned int CASCFS_SPLIT_DEPTH = 2;
+
+/**
+ * @brief File found by enumeration - its name is kept in an arena shared by all records
+ */
+struct CascfsRecord
+{
+    size_t nameOffset;
+    // start of the plain name within the name, 0 for files in the root
+    uint32_t plainOffset;
+    // length of the leading CASCFS_SPLIT_DEPTH directories, 0 if the file isn't that deep
+    uint32_t splitLen;
+    BYTE ckey[MD5_HASH_SIZE];
+    PCASC_CKEY_ENTRY ckeyEntry;
+};
+
+/**
+ * @brief Files under a single folder at CASCFS_SPLIT_DEPTH
+ */
+struct CascfsGroup
+{
+    FsNode* node;
+    std::vector<size_t> records;
+};
+
+/**
+ * @brief Run worker on threadCount threads (including the calling one), and wait for all of them
+ */
+static void cascfs_parallel(unsigned int threadCount, const std::function<void()>& worker)
+{
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Insert all files of the storage under baseNode
+ */
+void cascfs_populate(HANDLE hStorage, FsNode* baseNode, const CascfsOptions& options)
 {
     auto hs = TCascStorage::IsValid(hStorage);
-    cfFileTree.m_hStorage = hStorage;
+    unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
 
-    LOG_DEBUG << "Building file tree..";
+    LOG_DEBUG << "Enumerating files..";
 
     CASC_FIND_DATA findData;
     HANDLE handle = CascFindFirstFile(hStorage, "*", &findData, NULL);
@@ -355,44 +469,305 @@ void cascfs_populate(HANDLE hStorage)
         exit(GetLastError());
     }
 
+    std::vector<char> names;
+    std::vector<CascfsRecord> records;
     do {
         if (!findData.bFileAvailable) continue;
 
-        FsNode *folderNode;
-
+        CascfsRecord record;
+        record.nameOffset = names.size();
         if (findData.NameType == _CASC_NAME_TYPE::CascNameFull) {
-            folderNode = cfFileTree.GetParentNodeOfFilename(findData.szFileName);
+            names.insert(names.end(), findData.szFileName, findData.szFileName + strlen(findData.szFileName));
         }
         else if (findData.NameType == _CASC_NAME_TYPE::CascNameCKey) {
-            std::string targetFilepath = "CKEY\\";
-            targetFilepath += findData.szFileName;
-            folderNode = cfFileTree.GetParentNodeOfFilename(targetFilepath);
+            static const char ckeyFolder[] = "CKEY\\";
+            names.insert(names.end(), ckeyFolder, ckeyFolder + sizeof(ckeyFolder) - 1);
+            if (options.shardCKeys) {
+                names.insert(names.end(), findData.szFileName, findData.szFileName + 2);
+                names.push_back('\\');
+            }
+            names.insert(names.end(), findData.szFileName, findData.szFileName + strlen(findData.szFileName));
         }
         else {
             LOG_WARNING << "findData.bCanOpenByCKey is false for " << findData.szFileName;
             continue;
         }
-
-        auto fileNode = folderNode->Insert(FsNodeKind::File, findData.szPlainName);
-        fileNode->ckeyEntry = FindCKeyEntry_CKey(hs, findData.CKey);
+        names.push_back('\0');
+        memcpy(record.ckey, findData.CKey, sizeof(record.ckey));
+        records.push_back(record);
     } while (CascFindNextFile(handle, &findData));
     CascFindClose(handle);
+    LOG_DEBUG << "Files found: " << records.size();
+
+    // CKey entries are resolved concurrently - the map of the storage is only read from
+    LOG_DEBUG << "Resolving CKeys..";
+    const size_t resolveChunk = 4096;
+    std::atomic<size_t> nextChunk{0};
+    cascfs_parallel(threadCount, [&]() {
+        size_t begin;
+        while ((begin = nextChunk.fetch_add(resolveChunk, std::memory_order_relaxed)) < records.size()) {
+            size_t end = std::min(begin + resolveChunk, records.size());
+            for (size_t i = begin; i < end; ++i) {
+                auto& record = records[i];
+                record.ckeyEntry = FindCKeyEntry_CKey(hs, record.ckey);
+
+                const char* name = &names[record.nameOffset];
+                unsigned int depth = 0;
+                record.plainOffset = 0;
+                record.splitLen = 0;
+                for (uint32_t pos = 0; name[pos] != '\0'; ++pos) {
+                    if (name[pos] != ':' && name[pos] != '\\') continue;
+                    if (++depth == CASCFS_SPLIT_DEPTH) record.splitLen = pos;
+                    record.plainOffset = pos + 1;
+                }
+            }
+        }
+    });
+
+    // Folders down to CASCFS_SPLIT_DEPTH, and files above it are inserted right away.
+    // Deeper files are grouped by their folder at that depth - groups are disjoint subtrees, built concurrently.
+    LOG_DEBUG << "Building file tree..";
+    std::vector<CascfsGroup> groups;
+    std::unordered_map<FsNode*, size_t> groupIndex;
+    const char* lastSplit = NULL;
+    size_t lastSplitLen = 0;
+    size_t lastGroup = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto& record = records[i];
+        const char* name = &names[record.nameOffset];
+        if (record.ckeyEntry == NULL) {
+            LOG_WARNING << "CKey entry not found for " << name;
+            continue;
+        }
 
-    LOG_DEBUG << "Generating indexes..";
-    cfFileTree.GenerateNodeHashMap(cfFileTree.GetRootNode());
+        if (record.splitLen == 0) {
+            auto folderNode = record.plainOffset ? cfFileTree.GetFolderNode(baseNode, name, record.plainOffset - 1) : baseNode;
+            cfFileTree.InsertFile(folderNode, name + record.plainOffset, record.ckeyEntry, hStorage);
+            continue;
+        }
+
+        // names come grouped by directory, mostly
+        if (lastSplit == NULL || record.splitLen != lastSplitLen || memcmp(lastSplit, name, lastSplitLen) != 0) {
+            auto splitNode = cfFileTree.GetFolderNode(baseNode, name, record.splitLen);
+            auto result = groupIndex.emplace(splitNode, groups.size());
+            if (result.second) {
+                groups.push_back(CascfsGroup{ splitNode, {} });
+            }
+            lastSplit = name;
+            lastSplitLen = record.splitLen;
+            lastGroup = result.first->second;
+        }
+        groups[lastGroup].records.push_back(i);
+    }
+
+    // largest first, so that a big subtree doesn't end up being built alone at the end
+    std::vector<size_t> groupOrder(groups.size());
+    std::iota(groupOrder.begin(), groupOrder.end(), 0);
+    std::sort(groupOrder.begin(), groupOrder.end(), [&](size_t a, size_t b) {
+        return groups[a].records.size() > groups[b].records.size();
+    });
+    std::atomic<size_t> nextGroup{0};
+    cascfs_parallel(std::min<unsigned int>(threadCount, groups.size() + 1), [&]() {
+        size_t index;
+        while ((index = nextGroup.fetch_add(1, std::memory_order_relaxed)) < groupOrder.size()) {
+            const auto& group = groups[groupOrder[index]];
+            const char* lastDir = NULL;
+            size_t lastDirLen = 0;
+            FsNode* lastDirNode = NULL;
+            for (auto i : group.records) {
+                const auto& record = records[i];
+                const char* name = &names[record.nameOffset];
+                size_t dirLen = record.plainOffset - 1;
+                if (lastDir == NULL || dirLen != lastDirLen || memcmp(lastDir, name, dirLen) != 0) {
+                    lastDirNode = dirLen > record.splitLen
+                        ? cfFileTree.GetFolderNode(group.node, name + record.splitLen + 1, dirLen - record.splitLen - 1)
+                        : group.node;
+                    lastDir = name;
+                    lastDirLen = dirLen;
+                }
+                cfFileTree.InsertFile(lastDirNode, name + record.plainOffset, record.ckeyEntry, hStorage);
+            }
+        }
+    });
+    LOG_DEBUG << "Unique content entries: " << cfFileTree.GetContentCount();
 }
 
+/**
+ * @brief Collect content of files matching any of the patterns, or lying under a matching directory
+ *
+ * Patterns containing a separator are matched against the whole path from the root,
+ * others against the name of each node at any depth.
+ */
+static void cascfs_collectwarm(FsNode* fNode, const std::vector<std::string>& patterns, bool matched,
+    std::unordered_set<FsContent*>& seen, std::vector<FsContent*>& contents)
+{
+    if (!matched && fNode->m_kind != FsNodeKind::Root) {
+        for (const auto& pattern : patterns) {
+            if (pattern.find_first_of("/\\:") != std::string::npos) {
+                // skip leading slash of the node path
+                matched = globMatch(pattern, fNode->Filepath().substr(1));
+            }
+            else {
+                matched = globMatch(pattern, fNode->Name());
+            }
+            if (matched) break;
+        }
+    }
+
+    if (fNode->m_kind == FsNodeKind::File) {
+        if (matched && seen.insert(fNode->content).second) {
+            contents.push_back(fNode->content);
+        }
+        return;
+    }
+
+    for (auto childNode : fNode->Entries()) {
+        cascfs_collectwarm(childNode, patterns, matched, seen, contents);
+    }
+}
+
+/**
+ * @brief Pre-reads content in the background, so that first reads through the mount find
+ * data of the storage already in the page cache
+ *
+ * Workers run at idle CPU and I/O priority, open their own handles (those of the tree belong to the FUSE thread),
+ * and pause while foreground requests are being served. Each CascLib call is made under the storage lock,
+ * one chunk at a time, so that a foreground read waits for a single chunk at most.
+ */
+class CascfsWarmer {
+    const size_t m_chunkSize = 256 * 1024;
+    // pause while there was a foreground request within this window
+    const int64_t m_backoffMs = 100;
+
+    std::vector<FsContent*> m_contents;
+    std::atomic<size_t> m_next{0};
+    std::atomic<bool> m_stop{false};
+    std::vector<std::thread> m_workers;
+
+    bool waitForIdle()
+    {
+        while (!m_stop.load(std::memory_order_relaxed)) {
+            if (cascfs_now() - cfLastForeground.load(std::memory_order_relaxed) >= m_backoffMs) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(m_backoffMs / 4));
+        }
+        return false;
+    }
+
+    bool readChunk(HANDLE hFile, std::vector<char>& buffer, DWORD& readLen)
+    {
+        std::lock_guard<std::mutex> lock(cfStorageMutex);
+        return CascReadFile(hFile, buffer.data(), static_cast<DWORD>(buffer.size()), &readLen) && readLen > 0;
+    }
+
+    void work()
+    {
+        setThreadPriority(SchedPriority::Idle);
+        std::vector<char> buffer(m_chunkSize);
+
+        size_t index;
+        while ((index = m_next.fetch_add(1, std::memory_order_relaxed)) < m_contents.size()) {
+            if (!waitForIdle()) return;
+
+            HANDLE hFile;
+            bool opened;
+            {
+                std::lock_guard<std::mutex> lock(cfStorageMutex);
+                opened = CascOpenFile(m_contents[index]->hStorage, m_contents[index]->ckeyEntry->CKey, CASC_LOCALE_ALL, CASC_OPEN_BY_CKEY, &hFile);
+            }
+            if (!opened) {
+                LOG_DEBUG << "Warm-up couldn't open content of inode " << m_contents[index]->inode << " E" << GetLastError();
+                continue;
+            }
+            DWORD readLen = 0;
+            while (waitForIdle() && readChunk(hFile, buffer, readLen)) {
+                cfStats.warmBytes.fetch_add(readLen, std::memory_order_relaxed);
+                ioThrottle.read.consume(readLen);
+            }
+            {
+                std::lock_guard<std::mutex> lock(cfStorageMutex);
+                CascCloseFile(hFile);
+            }
+            cfStats.warmFiles.fetch_add(1, std::memory_order_relaxed);
+        }
+        LOG_DEBUG << "Warm-up worker finished";
+    }
+
+public:
+    CascfsWarmer(std::vector<FsContent*> contents)
+        : m_contents(std::move(contents))
+    {
+    }
+
+    ~CascfsWarmer()
+    {
+        stop();
+    }
+
+    void start(unsigned int threadCount)
+    {
+        threadCount = std::max(1u, std::min<unsigned int>(threadCount, m_contents.size()));
+        for (unsigned int i = 0; i < threadCount; ++i) {
+            m_workers.emplace_back(&CascfsWarmer::work, this);
+        }
+    }
+
+    void stop()
+    {
+        m_stop.store(true, std::memory_order_relaxed);
+        for (auto& worker : m_workers) {
+            worker.join();
+        }
+        m_workers.clear();
+    }
+};
+
 static struct fuse_operations cascf_oper;
 
-int cascfs_mount(const std::string& mountPoint, HANDLE hStorage)
+int cascfs_mount(const std::string& mountPoint, const std::vector<CascfsStorage>& storages, const CascfsOptions& options)
 {
     cascf_oper.getattr = cascfs_getattr;
     cascf_oper.open = cascfs_open;
     cascf_oper.read = cascfs_read;
+    cascf_oper.release = cascfs_release;
     cascf_oper.readdir = cascfs_readdir;
+#ifndef WIN32
+    cascf_oper.getxattr = cascfs_getxattr;
+    cascf_oper.listxattr = cascfs_listxattr;
+#endif
 
-    cascfs_populate(hStorage);
+    memReport.beginPhase("tree");
+    for (const auto& storage : storages) {
+        auto baseNode = cfFileTree.GetRootNode();
+        if (storage.name.length()) {
+            LOG_DEBUG << "Populating " << storage.name << "..";
+            baseNode = cfFileTree.InsertFolder(baseNode, storage.name);
+        }
+        cascfs_populate(storage.hStorage, baseNode, options);
+    }
+
+    // hidden directory with runtime statistics
+    auto controlFolder = cfFileTree.InsertFolder(cfFileTree.GetRootNode(), ".stormex");
+    cfFileTree.InsertControl(controlFolder, "stats");
+
+    cfStats.nodeCount = cfFileTree.GetNodeCount();
+    cfStats.treeMemory = cfFileTree.EstimateMemoryUsage(cfFileTree.GetRootNode());
+    LOG_DEBUG << "Tree nodes: " << cfStats.nodeCount << " ~" << formatFileSize(cfStats.treeMemory);
+
+    std::unique_ptr<CascfsWarmer> warmer;
+    if (options.warmPatterns.size()) {
+        std::unordered_set<FsContent*> seen;
+        std::vector<FsContent*> contents;
+        cascfs_collectwarm(cfFileTree.GetRootNode(), options.warmPatterns, false, seen, contents);
+        LOG_INFO << "Files to warm up: " << contents.size();
+        cfStats.warmTotal = contents.size();
+        if (contents.size()) {
+            warmer.reset(new CascfsWarmer(std::move(contents)));
+        }
+    }
 
+    memReport.beginPhase("mount");
     LOG_DEBUG << "Preparing to mount..";
 
 #ifndef WIN32
@@ -402,22 +777,44 @@ int cascfs_mount(const std::string& mountPoint, HANDLE hStorage)
     }
 #endif
 
+#ifndef WIN32
+    // Content of the storage doesn't change while mounted. Let the kernel hold on to attributes and lookups,
+    // so detailed listings of large directories don't have to come back for every entry.
+    // (FUSE 2 has no readdirplus to deliver them along with readdir)
+    // Inode numbers are also ours - paths sharing a CKey are reported as hardlinks of each other.
+    const char* fuseArgv[] = { "stormex", "-o", "attr_timeout=3600,entry_timeout=3600,kernel_cache,use_ino" };
+    struct fuse_args fArgs = FUSE_ARGS_INIT(3, const_cast<char**>(fuseArgv));
+    struct fuse_args* fArgsPtr = &fArgs;
+#else
+    struct fuse_args* fArgsPtr = NULL;
+#endif
+
     auto fChan = fuse_mount(mountPoint.c_str(), NULL);
     if (fChan != NULL) {
-        auto fHandle = fuse_new(fChan, NULL, &cascf_oper, sizeof(cascf_oper), NULL);
+        auto fHandle = fuse_new(fChan, fArgsPtr, &cascf_oper, sizeof(cascf_oper), NULL);
         if (fHandle != NULL) {
             LOG_INFO << "cascfs " << static_cast<void*>(fHandle) << " mounted at " << mountPoint;
             struct fuse_session *se = fuse_get_session(fHandle);
             if (fuse_set_signal_handlers(se) == 0) {
+                // only once mounted - warm-up mustn't delay the mount itself
+                if (warmer) {
+                    warmer->start(options.warmThreads);
+                }
                 LOG_DEBUG << "Entering CASC-FS loop..";
                 fuse_loop(fHandle);
                 LOG_DEBUG << "Leaving CASC-FS loop..";
+                if (warmer) {
+                    warmer->stop();
+                }
 
                 fuse_remove_signal_handlers(se);
             }
 
             fuse_unmount(mountPoint.c_str(), fChan);
             fuse_destroy(fHandle);
+#ifndef WIN32
+            fuse_opt_free_args(&fArgs);
+#endif
         }
         else {
             LOG_FATAL << "fuse_new failed " << static_cast<void*>(fHandle);
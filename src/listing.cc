@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "listing.hpp"
+#include "util.hpp"
+
+bool parseListFormat(const std::string& name, ListFormat& format)
+{
+    if (name == "text") format = ListFormat::Text;
+    else if (name == "tsv") format = ListFormat::Tsv;
+    else if (name == "ndjson") format = ListFormat::Ndjson;
+    else if (name == "bin") format = ListFormat::Bin;
+    else return false;
+
+    return true;
+}
+
+static void appendUInt(std::string& out, uint64_t value)
+{
+    char buff[24];
+    char* p = buff + sizeof(buff);
+    do {
+        *--p = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    out.append(p, buff + sizeof(buff) - p);
+}
+
+static void appendHex(std::string& out, const unsigned char* data, size_t dataLen)
+{
+    char buff[MD5_STRING_SIZE + 1];
+    bytesToHex(buff, data, dataLen);
+    out.append(buff, dataLen * 2);
+}
+
+static void appendLE(std::string& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i) {
+        out += static_cast<char>((value >> (i * 8)) & 0xFF);
+    }
+}
+
+/// escape content of a JSON string - without the surrounding quotes
+static void appendJsonString(std::string& out, const std::string& str)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    for (char ch : str) {
+        switch (ch) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+            {
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    out += "\\u00";
+                    out += hexDigits[(ch >> 4) & 0x0F];
+                    out += hexDigits[ch & 0x0F];
+                }
+                else {
+                    out += ch;
+                }
+                break;
+            }
+        }
+    }
+}
+
+ListingWriter::ListingWriter(StdoutWriter& writer, ListFormat format, bool details)
+    : m_writer(writer), m_format(format), m_details(details)
+{
+    m_line.reserve(4096);
+}
+
+void ListingWriter::appendText(const STORAGE_SEARCH_RESULT& entry)
+{
+    if (m_details) {
+        char sizeBuff[32];
+        size_t sizeLen = formatFileSize(sizeBuff, entry.fileSize);
+        // right aligned to 8 columns
+        if (sizeLen < 8) m_line.append(8 - sizeLen, ' ');
+        m_line.append(sizeBuff, sizeLen);
+        m_line += "  ";
+        appendHex(m_line, entry.CKey, sizeof(entry.CKey));
+        m_line += "  ";
+    }
+    m_line += entry.filename;
+    m_line += '\n';
+}
+
+void ListingWriter::appendTsv(const STORAGE_SEARCH_RESULT& entry)
+{
+    m_line += entry.filename;
+    m_line += '\t';
+    appendHex(m_line, entry.CKey, sizeof(entry.CKey));
+    m_line += '\t';
+    appendHex(m_line, entry.EKey, sizeof(entry.EKey));
+    m_line += '\t';
+    appendUInt(m_line, entry.fileSize);
+    m_line += '\n';
+}
+
+void ListingWriter::appendNdjson(const STORAGE_SEARCH_RESULT& entry, const char* status)
+{
+    m_line += "{";
+    if (status != NULL) {
+        m_line += "\"status\":\"";
+        m_line += status;
+        m_line += "\",";
+    }
+    m_line += "\"name\":\"";
+    appendJsonString(m_line, entry.filename);
+    m_line += "\",\"ckey\":\"";
+    appendHex(m_line, entry.CKey, sizeof(entry.CKey));
+    m_line += "\",\"ekey\":\"";
+    appendHex(m_line, entry.EKey, sizeof(entry.EKey));
+    m_line += "\",\"size\":";
+    appendUInt(m_line, entry.fileSize);
+    m_line += "}\n";
+}
+
+bool appendBinRecord(std::string& out, const STORAGE_SEARCH_RESULT& entry, uint64_t fileSize)
+{
+    // a wrapped length would desync every record that follows
+    if (entry.filename.size() > UINT16_MAX) {
+        PLOG_ERROR << "Name too long for a bin record, skipping: " << entry.filename.substr(0, 256) << "..";
+        return false;
+    }
+
+    // u16 name length | name | CKey[16] | EKey[16] | u64 size - little endian
+    appendLE(out, entry.filename.size(), 2);
+    out += entry.filename;
+    out.append(reinterpret_cast<const char*>(entry.CKey), sizeof(entry.CKey));
+    out.append(reinterpret_cast<const char*>(entry.EKey), sizeof(entry.EKey));
+    appendLE(out, fileSize, 8);
+    return true;
+}
+
+bool ListingWriter::appendBin(const STORAGE_SEARCH_RESULT& entry)
+{
+    return appendBinRecord(m_line, entry);
+}
+
+void ListingWriter::appendSummary(const DirectorySummary& summary)
+{
+    switch (m_format) {
+        case ListFormat::Text:
+        {
+            char sizeBuff[32];
+            size_t sizeLen = formatFileSize(sizeBuff, summary.size);
+            if (sizeLen < 8) m_line.append(8 - sizeLen, ' ');
+            m_line.append(sizeBuff, sizeLen);
+            m_line += "  ";
+            if (m_details) {
+                char filesBuff[24];
+                size_t filesLen = snprintf(filesBuff, sizeof(filesBuff), "%8llu", static_cast<unsigned long long>(summary.files));
+                m_line.append(filesBuff, filesLen);
+                m_line += "  ";
+            }
+            m_line += summary.name;
+            m_line += '\n';
+            break;
+        }
+
+        case ListFormat::Tsv:
+        {
+            m_line += summary.name;
+            m_line += '\t';
+            appendUInt(m_line, summary.size);
+            m_line += '\t';
+            appendUInt(m_line, summary.files);
+            m_line += '\n';
+            break;
+        }
+
+        case ListFormat::Ndjson:
+        {
+            m_line += "{\"name\":\"";
+            appendJsonString(m_line, summary.name);
+            m_line += "\",\"size\":";
+            appendUInt(m_line, summary.size);
+            m_line += ",\"files\":";
+            appendUInt(m_line, summary.files);
+            m_line += "}\n";
+            break;
+        }
+
+        case ListFormat::Bin:
+        {
+            // u16 name length | name | u64 size | u64 files - little endian
+            appendLE(m_line, summary.name.size(), 2);
+            m_line += summary.name;
+            appendLE(m_line, summary.size, 8);
+            appendLE(m_line, summary.files, 8);
+            break;
+        }
+    }
+}
+
+void ListingWriter::write(const DirectorySummary& summary)
+{
+    m_line.clear();
+    appendSummary(summary);
+    m_writer.write(m_line.data(), m_line.size());
+}
+
+void ListingWriter::write(const FileChange& change)
+{
+    m_line.clear();
+    const char status = static_cast<char>(change.status);
+
+    switch (m_format) {
+        case ListFormat::Text:
+        {
+            m_line += status;
+            m_line += "  ";
+            appendText(*change.entry);
+            break;
+        }
+
+        case ListFormat::Tsv:
+        {
+            m_line += status;
+            m_line += '\t';
+            appendTsv(*change.entry);
+            break;
+        }
+
+        case ListFormat::Ndjson:
+        {
+            const char statusStr[] = { status, '\0' };
+            appendNdjson(*change.entry, statusStr);
+            break;
+        }
+
+        case ListFormat::Bin:
+        {
+            // u8 status | record
+            m_line += status;
+            if (!appendBin(*change.entry)) return;
+            break;
+        }
+    }
+
+    m_writer.write(m_line.data(), m_line.size());
+}
+
+void ListingWriter::write(const STORAGE_SEARCH_RESULT& entry)
+{
+    m_line.clear();
+
+    switch (m_format) {
+        case ListFormat::Text: appendText(entry); break;
+        case ListFormat::Tsv: appendTsv(entry); break;
+        case ListFormat::Ndjson: appendNdjson(entry); break;
+        case ListFormat::Bin: if (!appendBin(entry)) return; break;
+    }
+
+    m_writer.write(m_line.data(), m_line.size());
+}
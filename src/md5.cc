@@ -0,0 +1,175 @@
+#include <string.h>
+#include <stdio.h>
+#include "md5.hpp"
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define MD5_STEP(f, a, b, c, d, x, t, s) \
+    (a) += f((b), (c), (d)) + (x) + (t); \
+    (a) = (((a) << (s)) | ((a) >> (32 - (s)))); \
+    (a) += (b);
+
+Md5::Md5()
+{
+    m_state[0] = 0x67452301;
+    m_state[1] = 0xefcdab89;
+    m_state[2] = 0x98badcfe;
+    m_state[3] = 0x10325476;
+}
+
+void Md5::transform(const unsigned char* block)
+{
+    uint32_t x[16];
+    for (size_t i = 0; i < 16; ++i) {
+        x[i] = static_cast<uint32_t>(block[i * 4])
+            | static_cast<uint32_t>(block[i * 4 + 1]) << 8
+            | static_cast<uint32_t>(block[i * 4 + 2]) << 16
+            | static_cast<uint32_t>(block[i * 4 + 3]) << 24;
+    }
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+
+    MD5_STEP(MD5_F, a, b, c, d, x[0], 0xd76aa478, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[1], 0xe8c7b756, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[2], 0x242070db, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[3], 0xc1bdceee, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[4], 0xf57c0faf, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[5], 0x4787c62a, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[6], 0xa8304613, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[7], 0xfd469501, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[8], 0x698098d8, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[9], 0x8b44f7af, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22)
+
+    MD5_STEP(MD5_G, a, b, c, d, x[1], 0xf61e2562, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[6], 0xc040b340, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[0], 0xe9b6c7aa, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[5], 0xd62f105d, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[4], 0xe7d3fbc8, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[9], 0x21e1cde6, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[3], 0xf4d50d87, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[8], 0x455a14ed, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[2], 0xfcefa3f8, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[7], 0x676f02d9, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20)
+
+    MD5_STEP(MD5_H, a, b, c, d, x[5], 0xfffa3942, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[8], 0x8771f681, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[1], 0xa4beea44, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[4], 0x4bdecfa9, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[7], 0xf6bb4b60, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[0], 0xeaa127fa, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[3], 0xd4ef3085, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[6], 0x04881d05, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[9], 0xd9d4d039, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[2], 0xc4ac5665, 23)
+
+    MD5_STEP(MD5_I, a, b, c, d, x[0], 0xf4292244, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[7], 0x432aff97, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[5], 0xfc93a039, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[3], 0x8f0ccc92, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[1], 0x85845dd1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[8], 0x6fa87e4f, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[6], 0xa3014314, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[4], 0xf7537e82, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[2], 0x2ad7d2bb, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[9], 0xeb86d391, 21)
+
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+}
+
+void Md5::update(const void* data, size_t len)
+{
+    auto src = static_cast<const unsigned char*>(data);
+    size_t used = m_length % 64;
+    m_length += len;
+
+    if (used) {
+        size_t fill = 64 - used;
+        if (len < fill) {
+            memcpy(m_block + used, src, len);
+            return;
+        }
+        memcpy(m_block + used, src, fill);
+        transform(m_block);
+        src += fill;
+        len -= fill;
+    }
+
+    while (len >= 64) {
+        transform(src);
+        src += 64;
+        len -= 64;
+    }
+
+    memcpy(m_block, src, len);
+}
+
+void Md5::finish(unsigned char* out)
+{
+    uint64_t bitLength = m_length * 8;
+    static const unsigned char padding[64] = { 0x80 };
+    size_t used = m_length % 64;
+    update(padding, used < 56 ? 56 - used : 120 - used);
+
+    unsigned char lengthBytes[8];
+    for (size_t i = 0; i < 8; ++i) {
+        lengthBytes[i] = static_cast<unsigned char>(bitLength >> (i * 8));
+    }
+    update(lengthBytes, sizeof(lengthBytes));
+
+    for (size_t i = 0; i < 4; ++i) {
+        out[i * 4] = static_cast<unsigned char>(m_state[i]);
+        out[i * 4 + 1] = static_cast<unsigned char>(m_state[i] >> 8);
+        out[i * 4 + 2] = static_cast<unsigned char>(m_state[i] >> 16);
+        out[i * 4 + 3] = static_cast<unsigned char>(m_state[i] >> 24);
+    }
+}
+
+bool md5File(const std::string& path, unsigned char* digest, std::vector<char>& buffer)
+{
+    FILE* fileStream = fopen(path.c_str(), "rb");
+    if (!fileStream) {
+        return false;
+    }
+    setvbuf(fileStream, NULL, _IONBF, 0);
+
+    Md5 md5;
+    size_t read;
+    while ((read = fread(buffer.data(), 1, buffer.size(), fileStream)) > 0) {
+        md5.update(buffer.data(), read);
+    }
+
+    bool success = !ferror(fileStream);
+    fclose(fileStream);
+    md5.finish(digest);
+
+    return success;
+}
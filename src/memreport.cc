@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+#include <new>
+
+#if defined(WIN32) || defined(_WIN32)
+    #include <malloc.h>
+    #define mallocUsableSize _msize
+#elif defined(__APPLE__)
+    #include <malloc/malloc.h>
+    #define mallocUsableSize malloc_size
+#else
+    #include <malloc.h>
+    #define mallocUsableSize malloc_usable_size
+#endif
+
+#ifndef WIN32
+    #include <sys/resource.h>
+#endif
+
+#include "memreport.hpp"
+#include "util.hpp"
+
+MemoryReport memReport;
+
+// set once, before any other thread exists
+static bool countingEnabled = false;
+static std::atomic<uint64_t> allocCount{0};
+static std::atomic<uint64_t> allocBytes{0};
+static std::atomic<uint64_t> freeCount{0};
+static std::atomic<uint64_t> freeBytes{0};
+// signed, blocks allocated before counting was enabled may be freed later on
+static std::atomic<int64_t> liveBytes{0};
+static std::atomic<int64_t> peakLiveBytes{0};
+
+static inline void countAlloc(void* ptr)
+{
+    // usable size is what's seen on free as well, no header has to be stored along the block
+    int64_t size = mallocUsableSize(ptr);
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+    int64_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    int64_t peak = peakLiveBytes.load(std::memory_order_relaxed);
+    while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+static inline void countFree(void* ptr)
+{
+    int64_t size = mallocUsableSize(ptr);
+    freeCount.fetch_add(1, std::memory_order_relaxed);
+    freeBytes.fetch_add(size, std::memory_order_relaxed);
+    liveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    if (countingEnabled) countAlloc(ptr);
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    void* ptr = malloc(size ? size : 1);
+    if (ptr && countingEnabled) countAlloc(ptr);
+    return ptr;
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (!ptr) return;
+    if (countingEnabled) countFree(ptr);
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+/**
+ * @brief Current and peak resident set size in bytes
+ */
+static void readRss(uint64_t& rss, uint64_t& peakRss)
+{
+    rss = 0;
+    peakRss = 0;
+#ifdef __linux__
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        unsigned long long value;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmRSS: %llu kB", &value) == 1) rss = value * 1024;
+            else if (sscanf(line, "VmHWM: %llu kB", &value) == 1) peakRss = value * 1024;
+        }
+        fclose(status);
+    }
+#elif !defined(WIN32)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // bytes on macOS
+        peakRss = usage.ru_maxrss;
+    }
+#endif
+}
+
+/**
+ * @brief Reset peak RSS to the current RSS, so it can be measured per phase
+ */
+static void resetPeakRss()
+{
+#ifdef __linux__
+    FILE* clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs) {
+        fputs("5", clearRefs);
+        fclose(clearRefs);
+    }
+#endif
+}
+
+void MemoryReport::enable()
+{
+    countingEnabled = true;
+}
+
+bool MemoryReport::isEnabled()
+{
+    return countingEnabled;
+}
+
+void MemoryReport::beginPhase(const char* name)
+{
+    if (!countingEnabled) return;
+    endPhase();
+
+    m_phases.push_back(Phase());
+    m_phases.back().name = name;
+    m_inPhase = true;
+    resetPeakRss();
+    peakLiveBytes.store(liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_startAllocCount = allocCount.load(std::memory_order_relaxed);
+    m_startAllocBytes = allocBytes.load(std::memory_order_relaxed);
+    m_startFreeCount = freeCount.load(std::memory_order_relaxed);
+    m_startFreeBytes = freeBytes.load(std::memory_order_relaxed);
+    m_phaseStart = std::chrono::steady_clock::now();
+}
+
+void MemoryReport::endPhase()
+{
+    if (!m_inPhase) return;
+    m_inPhase = false;
+
+    Phase& phase = m_phases.back();
+    phase.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_phaseStart).count();
+    phase.allocCount = allocCount.load(std::memory_order_relaxed) - m_startAllocCount;
+    phase.allocBytes = allocBytes.load(std::memory_order_relaxed) - m_startAllocBytes;
+    phase.freeCount = freeCount.load(std::memory_order_relaxed) - m_startFreeCount;
+    phase.freeBytes = freeBytes.load(std::memory_order_relaxed) - m_startFreeBytes;
+    phase.liveBytes = std::max<int64_t>(liveBytes.load(std::memory_order_relaxed), 0);
+    phase.peakLiveBytes = std::max<int64_t>(peakLiveBytes.load(std::memory_order_relaxed), 0);
+    readRss(phase.rss, phase.peakRss);
+}
+
+void MemoryReport::writeText(std::ostream& out) const
+{
+    char line[256];
+    snprintf(line, sizeof(line), "%-12s %8s %12s %10s %12s %10s %10s %10s %10s %10s\n",
+        "phase", "time", "allocs", "alloc", "frees", "freed", "live", "peak live", "rss", "peak rss");
+    out << line;
+
+    for (const auto& phase : m_phases) {
+        snprintf(line, sizeof(line), "%-12s %7.2fs %12llu %10s %12llu %10s %10s %10s %10s %10s\n",
+            phase.name.c_str(), phase.seconds,
+            static_cast<unsigned long long>(phase.allocCount), formatFileSize(phase.allocBytes).c_str(),
+            static_cast<unsigned long long>(phase.freeCount), formatFileSize(phase.freeBytes).c_str(),
+            formatFileSize(phase.liveBytes).c_str(), formatFileSize(phase.peakLiveBytes).c_str(),
+            formatFileSize(phase.rss).c_str(), formatFileSize(phase.peakRss).c_str());
+        out << line;
+    }
+}
+
+void MemoryReport::writeJson(std::ostream& out) const
+{
+    out << "{\"phases\":[";
+    for (size_t i = 0; i < m_phases.size(); ++i) {
+        const auto& phase = m_phases[i];
+        char line[512];
+        snprintf(line, sizeof(line),
+            "%s{\"name\":\"%s\",\"seconds\":%.6f,\"alloc_count\":%llu,\"alloc_bytes\":%llu,\"free_count\":%llu,\"free_bytes\":%llu,"
+            "\"live_bytes\":%llu,\"peak_live_bytes\":%llu,\"rss\":%llu,\"peak_rss\":%llu}",
+            i ? "," : "", phase.name.c_str(), phase.seconds,
+            static_cast<unsigned long long>(phase.allocCount), static_cast<unsigned long long>(phase.allocBytes),
+            static_cast<unsigned long long>(phase.freeCount), static_cast<unsigned long long>(phase.freeBytes),
+            static_cast<unsigned long long>(phase.liveBytes), static_cast<unsigned long long>(phase.peakLiveBytes),
+            static_cast<unsigned long long>(phase.rss), static_cast<unsigned long long>(phase.peakRss));
+        out << line;
+    }
+    out << "]}\n";
+}
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#ifdef WIN32
+    #include <process.h>
+    #define getpid _getpid
+#else
+    #include <unistd.h>
+#endif
+
+#include "objectstore.hpp"
+#include "common.hpp"
+#include "util.hpp"
+
+ObjectStore::ObjectStore(const std::string& path, bool symlinks) : m_path(path), m_symlinks(symlinks)
+{
+    // unique per process - stores can be shared by concurrent extractions
+    m_tempSuffix = ".tmp" + std::to_string(getpid());
+}
+
+bool ObjectStore::open()
+{
+    std::replace(m_path.begin(), m_path.end(), '\\', '/');
+    if (m_path.empty() || m_path.at(m_path.size() - 1) != '/') {
+        m_path += '/';
+    }
+
+    int tmp;
+    if ((tmp = ensureDirExists(m_path)) != 0) {
+        PLOG_ERROR << "Couldn't create object store directory: " << m_path << " E(" << tmp << ")";
+        return false;
+    }
+
+#ifndef WIN32
+    char* resolved = realpath(m_path.c_str(), NULL);
+    if (!resolved) {
+        PLOG_ERROR << "Couldn't resolve path of object store: " << m_path << " E(" << errno << ")";
+        return false;
+    }
+    m_path = resolved;
+    m_path += '/';
+    free(resolved);
+#endif
+
+    return true;
+}
+
+std::string ObjectStore::objectPath(const std::string& ckeyHex) const
+{
+    std::string path = m_path;
+    path.append(ckeyHex, 0, 2);
+    path += '/';
+    path += ckeyHex;
+    return path;
+}
+
+std::string ObjectStore::tempPath(const std::string& objectPath) const
+{
+    return objectPath + m_tempSuffix;
+}
+
+bool ObjectStore::acquire(const std::string& objectPath)
+{
+    struct stat info;
+    if (m_queued.count(objectPath) || stat(objectPath.c_str(), &info) == 0) {
+        m_reused++;
+        return false;
+    }
+
+    m_queued.insert(objectPath);
+    m_added++;
+    return true;
+}
+
+void ObjectStore::discard(const std::string& objectPath)
+{
+    if (m_queued.erase(objectPath)) {
+        m_added--;
+    }
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <new>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/uio.h>
+#endif
+
+#include "output.hpp"
+#include "common.hpp"
+#include "throttle.hpp"
+
+static const size_t STDOUT_BUFFER_SIZE = 1024 * 1024;
+
+StdoutWriter::StdoutWriter()
+{
+    m_fd = fileno(stdout);
+    m_mode = Mode::Stdio;
+    m_bufferSize = STDOUT_BUFFER_SIZE;
+
+#ifdef __linux__
+    m_mode = Mode::Write;
+
+    struct stat st;
+    if (fstat(m_fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        m_mode = Mode::Vmsplice;
+
+        // attempt to grow the pipe, so fewer round trips are needed - but buffers must never be smaller than the pipe
+        fcntl(m_fd, F_SETPIPE_SZ, static_cast<int>(STDOUT_BUFFER_SIZE));
+        int pipeSize = fcntl(m_fd, F_GETPIPE_SZ);
+        if (pipeSize > 0) {
+            m_bufferSize = std::max(m_bufferSize, static_cast<size_t>(pipeSize));
+        }
+    }
+
+    // page aligned, so that vmsplice can take whole pages
+    for (auto& buffer : m_buffers) {
+        if (posix_memalign(reinterpret_cast<void**>(&buffer), sysconf(_SC_PAGESIZE), m_bufferSize) != 0) {
+            throw std::bad_alloc();
+        }
+    }
+#else
+    for (auto& buffer : m_buffers) {
+        buffer = static_cast<char*>(malloc(m_bufferSize));
+        if (buffer == NULL) {
+            throw std::bad_alloc();
+        }
+    }
+#endif
+
+    PLOG_DEBUG << "stdout writer mode " << static_cast<int>(m_mode) << " buffer size " << m_bufferSize;
+}
+
+StdoutWriter::~StdoutWriter()
+{
+    flush();
+    for (auto& buffer : m_buffers) {
+        free(buffer);
+    }
+}
+
+bool StdoutWriter::emit(const char* data, size_t len, bool splice)
+{
+    if (m_failed) return false;
+    ioThrottle.write.consume(len);
+
+#ifdef __linux__
+    while (len > 0 && m_mode == Mode::Vmsplice && splice) {
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(data);
+        iov.iov_len = len;
+        ssize_t written = vmsplice(m_fd, &iov, 1, 0);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL || errno == ENOSYS) {
+                PLOG_DEBUG << "vmsplice not supported E(" << errno << "), falling back to write";
+                m_mode = Mode::Write;
+                break;
+            }
+            PLOG_ERROR << "Failed to write to stdout E(" << errno << ")";
+            m_failed = true;
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+
+    while (len > 0 && (m_mode == Mode::Write || m_mode == Mode::Vmsplice)) {
+        ssize_t written = ::write(m_fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            PLOG_ERROR << "Failed to write to stdout E(" << errno << ")";
+            m_failed = true;
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+#endif
+
+    if (len > 0 && m_mode == Mode::Stdio) {
+        if (fwrite(data, len, 1, stdout) != 1) {
+            PLOG_ERROR << "Failed to write to stdout E(" << errno << ")";
+            m_failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+char* StdoutWriter::reserve(size_t& available)
+{
+    available = m_bufferSize - m_used;
+    return m_buffers[m_current] + m_used;
+}
+
+bool StdoutWriter::commit(size_t len)
+{
+    m_used += len;
+    if (m_used < m_bufferSize) {
+        return !m_failed;
+    }
+
+    bool result = emit(m_buffers[m_current], m_used, true);
+    m_current ^= 1;
+    m_used = 0;
+    return result;
+}
+
+bool StdoutWriter::write(const void* data, size_t len)
+{
+    auto src = static_cast<const char*>(data);
+    while (len > 0) {
+        size_t available;
+        char* dst = reserve(available);
+        size_t chunk = std::min(available, len);
+        memcpy(dst, src, chunk);
+        if (!commit(chunk)) return false;
+        src += chunk;
+        len -= chunk;
+    }
+
+    return !m_failed;
+}
+
+bool StdoutWriter::flush()
+{
+    // Partially filled buffer is smaller than the pipe, handing over its pages wouldn't guarantee the other buffer
+    // has been consumed by the time we get back to it. It's copied instead, and the same buffer gets reused.
+    bool result = true;
+    if (m_used > 0) {
+        result = emit(m_buffers[m_current], m_used, false);
+        m_used = 0;
+    }
+    if (m_mode == Mode::Stdio) {
+        fflush(stdout);
+    }
+
+    return result && !m_failed;
+}
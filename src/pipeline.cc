@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <errno.h>
+
+#ifndef WIN32
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
+#include "pipeline.hpp"
+#include "common.hpp"
+#include "util.hpp"
+#include "throttle.hpp"
+
+ExtractPipeline::ExtractPipeline(size_t bufferCount, size_t bufferSize)
+{
+    for (size_t i = 0; i < bufferCount; ++i) {
+        m_buffers.emplace_back(new Buffer());
+        m_buffers.back()->data.resize(bufferSize);
+        m_freeBuffers.push_back(m_buffers.back().get());
+    }
+
+    m_writer = std::thread(&ExtractPipeline::run, this);
+}
+
+ExtractPipeline::~ExtractPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_opsQueued.notify_one();
+    m_writer.join();
+}
+
+ExtractPipeline::Buffer* ExtractPipeline::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_opsDone.wait(lock, [this] { return !m_freeBuffers.empty(); });
+
+    Buffer* buffer = m_freeBuffers.back();
+    m_freeBuffers.pop_back();
+    buffer->length = 0;
+
+    return buffer;
+}
+
+void ExtractPipeline::release(Buffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_freeBuffers.push_back(buffer);
+}
+
+void ExtractPipeline::queue(Op op)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ops.push_back(std::move(op));
+        m_submitted++;
+    }
+    m_opsQueued.notify_one();
+}
+
+void ExtractPipeline::open(const std::string& path)
+{
+    queue(Op{ OpType::Open, path, std::string(), nullptr, false });
+}
+
+void ExtractPipeline::write(Buffer* buffer)
+{
+    queue(Op{ OpType::Write, std::string(), std::string(), buffer, false });
+}
+
+void ExtractPipeline::close(const std::string& renameTo, bool readOnly)
+{
+    queue(Op{ OpType::Close, std::string(), renameTo, nullptr, readOnly });
+}
+
+void ExtractPipeline::link(const std::string& target, const std::string& path, bool symbolic)
+{
+    queue(Op{ OpType::Link, path, target, nullptr, symbolic });
+}
+
+size_t ExtractPipeline::drain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_opsDone.wait(lock, [this] { return m_completed == m_submitted; });
+
+    return m_failures;
+}
+
+std::vector<std::string> ExtractPipeline::takeFailedRenames()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> failedRenames;
+    failedRenames.swap(m_failedRenames);
+    return failedRenames;
+}
+
+void ExtractPipeline::run()
+{
+    std::deque<Op> batch;
+    FILE* fileStream = nullptr;
+    std::string filename;
+    // set once the current file has failed, to have it counted only once
+    bool fileFailed = false;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_opsQueued.wait(lock, [this] { return !m_ops.empty() || m_stopping; });
+            if (m_ops.empty()) {
+                break;
+            }
+            batch.swap(m_ops);
+        }
+
+        size_t failures = 0;
+        for (auto& op : batch) {
+            switch (op.type) {
+                case OpType::Open:
+                {
+                    int tmp;
+                    filename = op.path;
+                    fileFailed = false;
+                    // may be a link to an object of the store, which mustn't be written through
+                    remove(filename.c_str());
+                    if ((tmp = ensureDirExists(filename)) != 0) {
+                        PLOG_ERROR << "Couldn't create directory path for file: " << filename << " E(" << tmp << ")";
+                        fileFailed = true;
+                    }
+                    else if (!(fileStream = fopen(filename.c_str(), "wb"))) {
+                        PLOG_ERROR << "Failed to open file for writing: " << filename << " E(" << errno << ")";
+                        fileFailed = true;
+                    }
+                    else {
+                        // buffers are large enough, avoid copying them once again into stdio's own
+                        setvbuf(fileStream, NULL, _IONBF, 0);
+                    }
+                    if (fileFailed) failures++;
+                    break;
+                }
+
+                case OpType::Write:
+                {
+                    if (fileStream && fwrite(op.buffer->data.data(), 1, op.buffer->length, fileStream) != op.buffer->length) {
+                        PLOG_ERROR << "Failed to write: " << filename << " E(" << errno << ")";
+                        fclose(fileStream);
+                        fileStream = nullptr;
+                        if (!fileFailed) failures++;
+                        fileFailed = true;
+                    }
+                    ioThrottle.write.consume(op.buffer->length);
+                    // returned right away, rather than with the batch - the decoder may be waiting for it
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_freeBuffers.push_back(op.buffer);
+                    }
+                    m_opsDone.notify_all();
+                    break;
+                }
+
+                case OpType::Close:
+                {
+                    if (fileStream && fclose(fileStream) != 0 && !fileFailed) {
+                        PLOG_ERROR << "Failed to write: " << filename << " E(" << errno << ")";
+                        fileFailed = true;
+                        failures++;
+                    }
+                    fileStream = nullptr;
+
+                    if (op.target.empty()) {
+                        break;
+                    }
+#ifndef WIN32
+                    if (!fileFailed && op.flag && chmod(filename.c_str(), 0444) != 0) {
+                        PLOG_ERROR << "Failed to make " << filename << " read-only E(" << errno << ")";
+                        fileFailed = true;
+                        failures++;
+                    }
+#endif
+                    if (!fileFailed && rename(filename.c_str(), op.target.c_str()) != 0) {
+                        PLOG_ERROR << "Failed to move " << filename << " to " << op.target << " E(" << errno << ")";
+                        fileFailed = true;
+                        failures++;
+                    }
+                    if (fileFailed) {
+                        remove(filename.c_str());
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_failedRenames.push_back(op.target);
+                    }
+                    break;
+                }
+
+                case OpType::Link:
+                {
+                    int tmp;
+                    if ((tmp = ensureDirExists(op.path)) != 0) {
+                        PLOG_ERROR << "Couldn't create directory path for file: " << op.path << " E(" << tmp << ")";
+                        failures++;
+                        break;
+                    }
+#ifndef WIN32
+                    // object may have failed to be written - a symbolic link to it would dangle
+                    if (access(op.target.c_str(), F_OK) != 0) {
+                        PLOG_ERROR << "Failed to link " << op.path << " to " << op.target << " - it doesn't exist";
+                        failures++;
+                        break;
+                    }
+                    unlink(op.path.c_str());
+                    if ((op.flag ? symlink(op.target.c_str(), op.path.c_str()) : ::link(op.target.c_str(), op.path.c_str())) != 0) {
+                        PLOG_ERROR << "Failed to link " << op.path << " to " << op.target << " E(" << errno << ")";
+                        failures++;
+                    }
+#else
+                    PLOG_ERROR << "Linking is not supported on this platform: " << op.path;
+                    failures++;
+#endif
+                    break;
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_completed += batch.size();
+            m_failures += failures;
+        }
+        m_opsDone.notify_all();
+
+        batch.clear();
+    }
+
+    if (fileStream) {
+        fclose(fileStream);
+    }
+}
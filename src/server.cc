@@ -0,0 +1,477 @@
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <thread>
+
+#ifndef WIN32
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
+
+#include "server.hpp"
+#include "listing.hpp"
+#include "throttle.hpp"
+
+// largest request payload accepted, guards against garbage on the socket
+static const size_t MAX_REQUEST_SIZE = 16 * 1024 * 1024;
+// size of frames in which large responses are streamed
+static const size_t RESPONSE_FRAME_SIZE = 1024 * 1024;
+
+static uint64_t readLE(const char* data, size_t bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (i * 8);
+    }
+    return value;
+}
+
+static void appendLE(std::string& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i) {
+        out += static_cast<char>((value >> (i * 8)) & 0xFF);
+    }
+}
+
+static std::string normalizeName(std::string name)
+{
+    std::replace(name.begin(), name.end(), '/', '\\');
+    stringToLower(name);
+    return name;
+}
+
+#ifndef WIN32
+
+static volatile sig_atomic_t serverInterrupted = 0;
+
+static void onServerSignal(int)
+{
+    serverInterrupted = 1;
+}
+
+static bool readFull(int fd, void* data, size_t len)
+{
+    auto p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t r = ::read(fd, p, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static bool writeFull(int fd, const void* data, size_t len)
+{
+    ioThrottle.write.consume(len);
+    auto p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t w = ::write(fd, p, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        len -= w;
+    }
+    return true;
+}
+
+static bool writeFrame(int fd, uint8_t status, const char* payload, size_t len)
+{
+    char header[5];
+    header[0] = static_cast<char>(status);
+    for (size_t i = 0; i < 4; ++i) {
+        header[1 + i] = static_cast<char>((len >> (i * 8)) & 0xFF);
+    }
+    return writeFull(fd, header, sizeof(header)) && writeFull(fd, payload, len);
+}
+
+static bool writeFrame(int fd, uint8_t status, const std::string& payload = std::string())
+{
+    return writeFrame(fd, status, payload.data(), payload.size());
+}
+
+#endif
+
+StorageServer::StorageServer(StorageExplorer& explorer, const std::vector<STORAGE_SEARCH_RESULT*>& entries, const std::string& extractRoot)
+    : m_explorer(explorer), m_entries(entries), m_extractRoot(extractRoot)
+{
+    std::replace(m_extractRoot.begin(), m_extractRoot.end(), '\\', '/');
+    if (m_extractRoot.empty() || m_extractRoot.at(m_extractRoot.size() - 1) != '/') {
+        m_extractRoot += '/';
+    }
+
+    m_index.reserve(entries.size());
+    for (const auto& entry : entries) {
+        m_index[normalizeName(entry->filename)] = entry;
+    }
+}
+
+STORAGE_SEARCH_RESULT* StorageServer::findEntry(const std::string& name)
+{
+    auto it = m_index.find(normalizeName(name));
+    return it != m_index.end() ? it->second : NULL;
+}
+
+bool StorageServer::resolveTarget(const std::string& target, std::string& targetFilename)
+{
+    if (target.empty() || target[0] == '/' || target[0] == '\\' || target.find(':') != std::string::npos) {
+        return false;
+    }
+
+    size_t pos = 0;
+    while (pos <= target.size()) {
+        size_t end = target.find_first_of("/\\", pos);
+        if (end == std::string::npos) end = target.size();
+        if (target.compare(pos, end - pos, "..") == 0) {
+            return false;
+        }
+        pos = end + 1;
+    }
+
+    targetFilename = m_extractRoot + target;
+    return true;
+}
+
+#ifndef WIN32
+
+int StorageServer::serve(const std::string& socketPath)
+{
+    struct sockaddr_un addr;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        PLOG_FATAL << "Socket path is too long: " << socketPath;
+        return -2;
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        PLOG_FATAL << "Couldn't create socket E(" << errno << ")";
+        return -2;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    // remove stale socket left by previous instance - but nothing else that happens to be at the path
+    struct stat info;
+    if (lstat(socketPath.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            PLOG_FATAL << "Path exists and isn't a socket: " << socketPath;
+            close(listenFd);
+            return -2;
+        }
+        unlink(socketPath.c_str());
+    }
+    if (bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+        PLOG_FATAL << "Couldn't listen on " << socketPath << " E(" << errno << ")";
+        close(listenFd);
+        return -2;
+    }
+    // clients can read anything from the storage and write into the extraction directory - owner only
+    chmod(socketPath.c_str(), 0600);
+
+    // disconnected clients shouldn't take the server down; signals interrupt accept(), letting us clean up
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onServerSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // client threads inherit a mask blocking these - so signals are delivered to the thread blocked in accept()
+    sigset_t shutdownSignals;
+    sigemptyset(&shutdownSignals);
+    sigaddset(&shutdownSignals, SIGINT);
+    sigaddset(&shutdownSignals, SIGTERM);
+
+    PLOG_INFO << "Serving " << m_entries.size() << " files at " << socketPath;
+
+    while (!serverInterrupted) {
+        int clientFd = accept(listenFd, NULL, NULL);
+        reapClients(false);
+        if (clientFd < 0) {
+            if (errno == EINTR) continue;
+            PLOG_ERROR << "accept failed E(" << errno << ")";
+            continue;
+        }
+
+        PLOG_DEBUG << "Client connected " << clientFd;
+        sigset_t prevSignals;
+        pthread_sigmask(SIG_BLOCK, &shutdownSignals, &prevSignals);
+        m_clients.emplace_back();
+        auto& client = m_clients.back();
+        client.fd = clientFd;
+        client.thread = std::thread([this, &client] {
+            handleClient(client.fd);
+            client.finished = true;
+        });
+        pthread_sigmask(SIG_SETMASK, &prevSignals, NULL);
+    }
+
+    PLOG_INFO << "Shutting down server..";
+    close(listenFd);
+    unlink(socketPath.c_str());
+
+    // wake up clients blocked on their sockets, entries they use are about to go away
+    for (auto& client : m_clients) {
+        shutdown(client.fd, SHUT_RDWR);
+    }
+    reapClients(true);
+
+    return 0;
+}
+
+void StorageServer::reapClients(bool all)
+{
+    for (auto it = m_clients.begin(); it != m_clients.end();) {
+        if (all || it->finished) {
+            it->thread.join();
+            close(it->fd);
+            it = m_clients.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void StorageServer::handleClient(int fd)
+{
+    std::string payload;
+
+    while (true) {
+        char header[5];
+        if (!readFull(fd, header, sizeof(header))) break;
+
+        uint8_t request = static_cast<uint8_t>(header[0]);
+        size_t len = readLE(header + 1, 4);
+        if (len > MAX_REQUEST_SIZE) {
+            writeFrame(fd, STATUS_BAD_REQUEST);
+            break;
+        }
+
+        payload.resize(len);
+        if (len && !readFull(fd, &payload[0], len)) break;
+
+        bool result;
+        switch (request) {
+            case REQ_LIST: result = handleList(fd, payload); break;
+            case REQ_STAT: result = handleStat(fd, payload); break;
+            case REQ_READ: result = handleRead(fd, payload); break;
+            case REQ_EXTRACT: result = handleExtract(fd, payload); break;
+            default: result = writeFrame(fd, STATUS_BAD_REQUEST); break;
+        }
+        if (!result) break;
+    }
+
+    PLOG_DEBUG << "Client disconnected " << fd;
+}
+
+bool StorageServer::handleList(int fd, const std::string& payload)
+{
+    std::string out;
+    out.reserve(RESPONSE_FRAME_SIZE + 2048);
+
+    for (const auto& entry : m_entries) {
+        if (!payload.empty() && !stringFindIC(entry->filename, payload)) continue;
+
+        appendBinRecord(out, *entry);
+        if (out.size() >= RESPONSE_FRAME_SIZE) {
+            if (!writeFrame(fd, STATUS_PARTIAL, out)) return false;
+            out.clear();
+        }
+    }
+
+    return writeFrame(fd, STATUS_OK, out);
+}
+
+bool StorageServer::handleStat(int fd, const std::string& payload)
+{
+    std::string out;
+    size_t pos = 0;
+
+    // u8 found, followed by the record if it was
+    while (pos + 2 <= payload.size()) {
+        size_t nameLen = readLE(payload.data() + pos, 2);
+        pos += 2;
+        if (pos + nameLen > payload.size()) {
+            return writeFrame(fd, STATUS_BAD_REQUEST);
+        }
+
+        auto entry = findEntry(payload.substr(pos, nameLen));
+        pos += nameLen;
+        out += static_cast<char>(entry != NULL ? 1 : 0);
+        if (entry != NULL) {
+            appendBinRecord(out, *entry);
+        }
+    }
+    if (pos != payload.size()) {
+        return writeFrame(fd, STATUS_BAD_REQUEST);
+    }
+
+    return writeFrame(fd, STATUS_OK, out);
+}
+
+bool StorageServer::handleRead(int fd, const std::string& payload)
+{
+    if (payload.size() < 16) {
+        return writeFrame(fd, STATUS_BAD_REQUEST);
+    }
+
+    uint64_t offset = readLE(payload.data(), 8);
+    uint64_t length = readLE(payload.data() + 8, 8);
+    auto entry = findEntry(payload.substr(16));
+    if (entry == NULL) {
+        return writeFrame(fd, STATUS_NOT_FOUND);
+    }
+    if (offset >= entry->fileSize) {
+        return writeFrame(fd, STATUS_OK);
+    }
+    length = std::min(length, static_cast<uint64_t>(entry->fileSize) - offset);
+    if (length == 0) {
+        return writeFrame(fd, STATUS_OK);
+    }
+
+    std::vector<char> buffer(std::min(length, static_cast<uint64_t>(RESPONSE_FRAME_SIZE)));
+    HANDLE hFile;
+    {
+        std::lock_guard<std::mutex> lock(m_storageMutex);
+        if (!m_explorer.openFile(*entry, &hFile)) {
+            PLOG_ERROR << "Failed to open " << entry->filename << " E(" << GetLastError() << ")";
+            return writeFrame(fd, STATUS_IO_ERROR);
+        }
+        LONG offsetHigh = static_cast<LONG>(offset >> 32);
+        CascSetFilePointer(hFile, static_cast<LONG>(offset & 0xFFFFFFFF), &offsetHigh, FILE_BEGIN);
+    }
+
+    bool result = true;
+    while (length > 0) {
+        DWORD read = 0;
+        bool readResult;
+        {
+            std::lock_guard<std::mutex> lock(m_storageMutex);
+            readResult = CascReadFile(hFile, buffer.data(), static_cast<DWORD>(std::min(length, static_cast<uint64_t>(buffer.size()))), &read);
+        }
+        if (!readResult || read == 0) {
+            break;
+        }
+        ioThrottle.read.consume(read);
+        length -= read;
+
+        if (length > 0 && !writeFrame(fd, STATUS_PARTIAL, buffer.data(), read)) {
+            result = false;
+            break;
+        }
+        if (length == 0) {
+            result = writeFrame(fd, STATUS_OK, buffer.data(), read);
+        }
+    }
+    if (result && length > 0) {
+        // stopped short, end the response
+        result = writeFrame(fd, STATUS_IO_ERROR);
+    }
+
+    std::lock_guard<std::mutex> lock(m_storageMutex);
+    CascCloseFile(hFile);
+
+    return result;
+}
+
+bool StorageServer::handleExtract(int fd, const std::string& payload)
+{
+    if (payload.size() < 2) {
+        return writeFrame(fd, STATUS_BAD_REQUEST);
+    }
+    size_t nameLen = readLE(payload.data(), 2);
+    if (2 + nameLen >= payload.size()) {
+        return writeFrame(fd, STATUS_BAD_REQUEST);
+    }
+
+    auto entry = findEntry(payload.substr(2, nameLen));
+    if (entry == NULL) {
+        return writeFrame(fd, STATUS_NOT_FOUND);
+    }
+
+    std::string targetFilename;
+    if (!resolveTarget(payload.substr(2 + nameLen), targetFilename)) {
+        return writeFrame(fd, STATUS_BAD_REQUEST);
+    }
+
+    int tmp;
+    if ((tmp = ensureDirExists(targetFilename)) != 0) {
+        PLOG_ERROR << "Couldn't create directory path for file: " << targetFilename << " E(" << tmp << ")";
+        return writeFrame(fd, STATUS_IO_ERROR);
+    }
+    // may be a link to a shared object, write a file of its own instead
+    unlink(targetFilename.c_str());
+    FILE* fileStream = fopen(targetFilename.c_str(), "wb");
+    if (!fileStream) {
+        PLOG_ERROR << "Failed to open file for writing: " << targetFilename << " E(" << errno << ")";
+        return writeFrame(fd, STATUS_IO_ERROR);
+    }
+
+    HANDLE hFile;
+    {
+        std::lock_guard<std::mutex> lock(m_storageMutex);
+        if (!m_explorer.openFile(*entry, &hFile)) {
+            PLOG_ERROR << "Failed to open " << entry->filename << " E(" << GetLastError() << ")";
+            fclose(fileStream);
+            unlink(targetFilename.c_str());
+            return writeFrame(fd, STATUS_IO_ERROR);
+        }
+    }
+
+    // storage is locked only while decoding, writing (and its throttling) doesn't hold up other clients
+    std::vector<char> buffer(RESPONSE_FRAME_SIZE);
+    uint64_t fileSize = 0;
+    bool written = true;
+    while (true) {
+        DWORD read = 0;
+        bool readResult;
+        {
+            std::lock_guard<std::mutex> lock(m_storageMutex);
+            readResult = CascReadFile(hFile, buffer.data(), static_cast<DWORD>(buffer.size()), &read);
+        }
+        if (!readResult || read == 0) {
+            break;
+        }
+        ioThrottle.read.consume(read);
+        ioThrottle.write.consume(read);
+        if (fwrite(buffer.data(), 1, read, fileStream) != read) {
+            PLOG_ERROR << "Failed to write: " << targetFilename << " E(" << errno << ")";
+            written = false;
+            break;
+        }
+        fileSize += read;
+    }
+    if (fclose(fileStream) != 0) {
+        written = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_storageMutex);
+        CascCloseFile(hFile);
+    }
+
+    if (!written || fileSize < entry->fileSize) {
+        unlink(targetFilename.c_str());
+        return writeFrame(fd, STATUS_IO_ERROR);
+    }
+
+    std::string out;
+    appendLE(out, fileSize, 8);
+    return writeFrame(fd, STATUS_OK, out);
+}
+
+#else
+
+int StorageServer::serve(const std::string& socketPath)
+{
+    PLOG_FATAL << "Serving over a socket is not supported on this platform";
+    return -2;
+}
+
+#endif
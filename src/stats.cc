@@ -0,0 +1,52 @@
+#include "stats.hpp"
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::Record(uint64_t ns)
+{
+    // bucket index is the bit length of the value, bucket N holds [2^(N-1), 2^N)
+    size_t idx = 0;
+    while (ns != 0 && idx < BUCKET_COUNT - 1) {
+        ns >>= 1;
+        ++idx;
+    }
+    m_buckets[idx].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Count() const
+{
+    uint64_t total = 0;
+    for (const auto& bucket : m_buckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const
+{
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) return 0;
+
+    uint64_t target = static_cast<uint64_t>(p * total);
+    if (target < 1) target = 1;
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        cumulative += counts[i];
+        if (cumulative >= target) {
+            return 1ULL << i;
+        }
+    }
+
+    return 1ULL << (BUCKET_COUNT - 1);
+}
@@ -1,4 +1,17 @@
+#include <stdint.h>
+
+#ifndef WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
 #include "storage.hpp"
+#include "listing.hpp"
+#include "throttle.hpp"
+
+// decoded in chunks, after each one the pages are unmapped - keeps RSS flat on large files
+static const size_t MAPPING_CHUNK_SIZE = 16 * 1024 * 1024;
 
 StorageExplorer::~StorageExplorer()
 {
@@ -25,10 +38,10 @@ bool StorageExplorer::closeStorage()
     return CascCloseStorage(m_hStorage);
 }
 
-bool StorageExplorer::enumerateFiles(std::vector<STORAGE_SEARCH_RESULT*>& searchResults)
+bool StorageExplorer::enumerateFiles(std::vector<STORAGE_SEARCH_RESULT*>& searchResults, const std::string& mask)
 {
     CASC_FIND_DATA findData;
-    HANDLE handle = CascFindFirstFile(m_hStorage, "*", &findData, NULL);
+    HANDLE handle = CascFindFirstFile(m_hStorage, mask.c_str(), &findData, NULL);
 
     if (handle == INVALID_HANDLE_VALUE) {
         PLOG_FATAL << "CascFindFirstFile E(" << GetLastError() << ")";
@@ -45,6 +58,8 @@ bool StorageExplorer::enumerateFiles(std::vector<STORAGE_SEARCH_RESULT*>& search
         record->fileSize = findData.FileSize;
         record->fileAvailable = findData.FileSize;
         record->nameType = findData.NameType;
+        record->hasCKey = findData.bCanOpenByCKey;
+        record->hasEKey = findData.bCanOpenByEKey;
         searchResults.push_back(record);
     } while (CascFindNextFile(handle, &findData));
 
@@ -53,7 +68,19 @@ bool StorageExplorer::enumerateFiles(std::vector<STORAGE_SEARCH_RESULT*>& search
     return true;
 }
 
-size_t StorageExplorer::extractFileToPath(const std::string& storedFilename, const std::string& targetFilename)
+bool StorageExplorer::openFile(const STORAGE_SEARCH_RESULT& entry, HANDLE* hFile)
+{
+    // keys known from the enumeration spare CascLib hashing the name and resolving it through the root again
+    if (entry.hasCKey) {
+        return CascOpenFile(m_hStorage, entry.CKey, CASC_LOCALE_ALL, CASC_OPEN_BY_CKEY, hFile);
+    }
+    if (entry.hasEKey) {
+        return CascOpenFile(m_hStorage, entry.EKey, CASC_LOCALE_ALL, CASC_OPEN_BY_EKEY, hFile);
+    }
+    return CascOpenFile(m_hStorage, entry.filename.c_str(), CASC_LOCALE_ALL, 0, hFile);
+}
+
+size_t StorageExplorer::extractFileToPath(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename)
 {
     int tmp;
 
@@ -62,9 +89,11 @@ size_t StorageExplorer::extractFileToPath(const std::string& storedFilename, con
         return 0;
     }
 
+    // may be a link to an object of the store, which mustn't be written through
+    remove(targetFilename.c_str());
     FILE* fileStream = fopen(targetFilename.c_str(), "wb");
     if (fileStream) {
-        size_t fileSize = extractFileData(storedFilename, fileStream);
+        size_t fileSize = extractFileData(entry, fileStream);
         fclose(fileStream);
         return fileSize;
     }
@@ -74,27 +103,407 @@ size_t StorageExplorer::extractFileToPath(const std::string& storedFilename, con
     }
 }
 
-size_t StorageExplorer::extractFileData(const std::string& storedFilename, FILE* outStream)
+size_t StorageExplorer::extractFileToPath(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename, ExtractPipeline& pipeline)
+{
+    HANDLE hFile;
+    size_t fileSize = 0;
+    if (!openFile(entry, &hFile)) {
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " E(" << GetLastError() << ")";
+        return 0;
+    }
+
+    Md5 md5;
+    uint64_t remaining = seekRange(hFile);
+    pipeline.open(targetFilename);
+    while (remaining > 0) {
+        ExtractPipeline::Buffer* buffer = pipeline.acquire();
+        DWORD read = 0;
+        DWORD toRead = static_cast<DWORD>(std::min(remaining, static_cast<uint64_t>(buffer->data.size())));
+        if (!CascReadFile(hFile, buffer->data.data(), toRead, &read) || read == 0) {
+            pipeline.release(buffer);
+            break;
+        }
+        ioThrottle.read.consume(read);
+
+        if (m_verify) md5.update(buffer->data.data(), read);
+        buffer->length = read;
+        pipeline.write(buffer);
+        fileSize += read;
+        remaining -= read;
+    }
+    pipeline.close();
+
+    if (m_verify) verifyContentKey(hFile, md5, entry.filename);
+    CascCloseFile(hFile);
+
+    return fileSize;
+}
+
+size_t StorageExplorer::extractFileToStore(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename, ObjectStore& store, ExtractPipeline& pipeline)
+{
+    HANDLE hFile = NULL;
+    BYTE ckey[MD5_HASH_SIZE];
+    if (entry.hasCKey) {
+        // known from the enumeration - the file is opened only if the store lacks its object
+        memcpy(ckey, entry.CKey, sizeof(ckey));
+    }
+    else {
+        if (!openFile(entry, &hFile)) {
+            PLOG_ERROR << "Failed to extract: " << entry.filename << " E(" << GetLastError() << ")";
+            return 0;
+        }
+        if (!CascGetFileInfo(hFile, CascFileContentKey, ckey, sizeof(ckey), NULL)) {
+            PLOG_ERROR << "Couldn't retrieve CKey of: " << entry.filename << " E(" << GetLastError() << ")";
+            CascCloseFile(hFile);
+            return 0;
+        }
+    }
+
+    char ckeyHex[MD5_HASH_SIZE * 2 + 1];
+    bytesToHex(ckeyHex, ckey, sizeof(ckey));
+    std::string objectPath = store.objectPath(ckeyHex);
+
+    // objects the writer failed to put in place are no longer queued, they're written anew
+    for (const auto& failedPath : pipeline.takeFailedRenames()) {
+        store.discard(failedPath);
+    }
+
+    size_t fileSize = 0;
+    if (store.acquire(objectPath)) {
+        if (hFile == NULL && !openFile(entry, &hFile)) {
+            PLOG_ERROR << "Failed to extract: " << entry.filename << " E(" << GetLastError() << ")";
+            store.discard(objectPath);
+            return 0;
+        }
+        DWORD sizeHigh = 0;
+        DWORD sizeLow = CascGetFileSize(hFile, &sizeHigh);
+        uint64_t contentSize = (static_cast<uint64_t>(sizeHigh) << 32) | sizeLow;
+        if (sizeLow == CASC_INVALID_SIZE) {
+            PLOG_ERROR << "Failed to retrieve size of: " << entry.filename << " E(" << GetLastError() << ")";
+            store.discard(objectPath);
+            CascCloseFile(hFile);
+            return 0;
+        }
+        Md5 md5;
+        std::string tempPath = store.tempPath(objectPath);
+        pipeline.open(tempPath);
+        while (true) {
+            ExtractPipeline::Buffer* buffer = pipeline.acquire();
+            DWORD read = 0;
+            if (!CascReadFile(hFile, buffer->data.data(), static_cast<DWORD>(buffer->data.size()), &read) || read == 0) {
+                pipeline.release(buffer);
+                break;
+            }
+            ioThrottle.read.consume(read);
+
+            if (m_verify) md5.update(buffer->data.data(), read);
+            buffer->length = read;
+            pipeline.write(buffer);
+            fileSize += read;
+        }
+
+        // objects are never rewritten once present - anything short or corrupted mustn't make it into the store
+        bool complete = fileSize == contentSize;
+        if (!complete) {
+            PLOG_ERROR << "Failed to extract: " << entry.filename << " - decoded " << fileSize << " of " << contentSize << " bytes";
+        }
+        else if (m_verify) {
+            complete = verifyContentKey(hFile, md5, entry.filename);
+        }
+        if (!complete) {
+            pipeline.close();
+            // the writer has to let go of the file first
+            pipeline.drain();
+            remove(tempPath.c_str());
+            store.discard(objectPath);
+            CascCloseFile(hFile);
+            return 0;
+        }
+        pipeline.close(objectPath, true);
+    }
+    else {
+        PLOG_DEBUG << "Object already present: " << objectPath;
+    }
+    if (hFile != NULL) CascCloseFile(hFile);
+
+    pipeline.link(objectPath, targetFilename, store.useSymlinks());
+
+    return fileSize;
+}
+
+size_t StorageExplorer::extractFileToMapping(const STORAGE_SEARCH_RESULT& entry, const std::string& targetFilename)
+{
+#ifdef WIN32
+    return extractFileToPath(entry, targetFilename);
+#else
+    int tmp;
+    HANDLE hFile;
+    if (!openFile(entry, &hFile)) {
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " E(" << GetLastError() << ")";
+        return 0;
+    }
+
+    DWORD sizeHigh = 0;
+    DWORD sizeLow = CascGetFileSize(hFile, &sizeHigh);
+    uint64_t expectedSize = (static_cast<uint64_t>(sizeHigh) << 32) | sizeLow;
+    if (sizeLow != CASC_INVALID_SIZE) {
+        expectedSize = std::min(expectedSize, seekRange(hFile));
+    }
+    if (sizeLow == CASC_INVALID_SIZE || expectedSize == 0 || expectedSize > SIZE_MAX) {
+        CascCloseFile(hFile);
+        return extractFileToPath(entry, targetFilename);
+    }
+    size_t mappingSize = static_cast<size_t>(expectedSize);
+
+    if ((tmp = ensureDirExists(targetFilename)) != 0) {
+        PLOG_ERROR << "Couldn't create directory path for file: " << targetFilename << " E(" << tmp << ")";
+        CascCloseFile(hFile);
+        return 0;
+    }
+
+    // may be a link to an object of the store, which mustn't be written through
+    unlink(targetFilename.c_str());
+    int fd = open(targetFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        PLOG_ERROR << "Failed to open file for writing: " << targetFilename << " E(" << errno << ")";
+        CascCloseFile(hFile);
+        return 0;
+    }
+
+    bool sized = ftruncate(fd, static_cast<off_t>(mappingSize)) == 0;
+#ifdef __linux__
+    // reserve the blocks - running out of space on a sparse file would otherwise raise SIGBUS on write to the mapping
+    if (sized && fallocate(fd, 0, 0, static_cast<off_t>(mappingSize)) != 0 && errno == ENOSPC) {
+        sized = false;
+    }
+#endif
+    char* mapping = sized ? static_cast<char*>(mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) : static_cast<char*>(MAP_FAILED);
+    if (mapping == MAP_FAILED) {
+        PLOG_DEBUG << "Couldn't map " << targetFilename << " E(" << errno << "), falling back to regular writes";
+        close(fd);
+        CascCloseFile(hFile);
+        return extractFileToPath(entry, targetFilename);
+    }
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+    Md5 md5;
+    size_t fileSize = 0;
+    while (fileSize < mappingSize) {
+        size_t chunkSize = std::min(mappingSize - fileSize, MAPPING_CHUNK_SIZE);
+        size_t chunkFilled = 0;
+        DWORD read = 0;
+        while (chunkFilled < chunkSize) {
+            if (!CascReadFile(hFile, mapping + fileSize + chunkFilled, static_cast<DWORD>(chunkSize - chunkFilled), &read) || read == 0) {
+                break;
+            }
+            ioThrottle.read.consume(read);
+            chunkFilled += read;
+        }
+        // written back by the kernel, but still accounted as it's filled
+        ioThrottle.write.consume(chunkFilled);
+
+        if (m_verify) md5.update(mapping + fileSize, chunkFilled);
+        // pages stay in the page cache (dirty ones get written back), they're only dropped from this process
+        madvise(mapping + fileSize, chunkFilled, MADV_DONTNEED);
+        fileSize += chunkFilled;
+        if (chunkFilled < chunkSize) break;
+    }
+
+    munmap(mapping, mappingSize);
+    if (fileSize != mappingSize) {
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " - decoded " << fileSize << " of " << mappingSize << " bytes";
+        if (ftruncate(fd, static_cast<off_t>(fileSize)) != 0) {
+            // otherwise left at full size, padded with zeros
+            PLOG_ERROR << "Failed to truncate: " << targetFilename << " E(" << errno << ")";
+            close(fd);
+            unlink(targetFilename.c_str());
+            CascCloseFile(hFile);
+            return 0;
+        }
+    }
+    close(fd);
+
+    if (m_verify) verifyContentKey(hFile, md5, entry.filename);
+    CascCloseFile(hFile);
+
+    return fileSize;
+#endif
+}
+
+size_t StorageExplorer::extractFileData(const STORAGE_SEARCH_RESULT& entry, FILE* outStream)
 {
     char buffer[0x1000];
 
     HANDLE hFile;
     size_t fileSize = 0;
-    if (CascOpenFile(m_hStorage, storedFilename.c_str(), CASC_LOCALE_ALL, 0, &hFile)) {
-        DWORD read;
-        do {
-            if (CascReadFile(hFile, &buffer, sizeof(buffer), &read)) {
-                fwrite(&buffer, read, 1, outStream);
-                fileSize += read;
+    if (openFile(entry, &hFile)) {
+        Md5 md5;
+        uint64_t remaining = seekRange(hFile);
+        while (remaining > 0) {
+            DWORD read = 0;
+            DWORD toRead = static_cast<DWORD>(std::min(remaining, static_cast<uint64_t>(sizeof(buffer))));
+            if (!CascReadFile(hFile, &buffer, toRead, &read) || read == 0) {
+                break;
             }
-        } while (read > 0);
+            ioThrottle.read.consume(read);
+            fwrite(&buffer, read, 1, outStream);
+            ioThrottle.write.consume(read);
+            if (m_verify) md5.update(buffer, read);
+            fileSize += read;
+            remaining -= read;
+        }
 
+        if (m_verify) verifyContentKey(hFile, md5, entry.filename);
         CascCloseFile(hFile);
     }
     else {
-        PLOG_ERROR << "Failed to extract: " << storedFilename << " to " << static_cast<void*>(outStream) << " E(" << errno << ")";
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " to " << static_cast<void*>(outStream) << " E(" << errno << ")";
+        return 0;
+    }
+
+    return fileSize;
+}
+
+size_t StorageExplorer::extractFileData(const STORAGE_SEARCH_RESULT& entry, StdoutWriter& writer)
+{
+    HANDLE hFile;
+    size_t fileSize = 0;
+    if (openFile(entry, &hFile)) {
+        Md5 md5;
+        fileSize = decodeToWriter(hFile, seekRange(hFile), writer, md5);
+
+        if (m_verify) verifyContentKey(hFile, md5, entry.filename);
+        CascCloseFile(hFile);
+    }
+    else {
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " to stdout E(" << errno << ")";
+        return 0;
+    }
+
+    return fileSize;
+}
+
+size_t StorageExplorer::extractFileFramed(const STORAGE_SEARCH_RESULT& entry, StdoutWriter& writer)
+{
+    HANDLE hFile;
+    CASC_FILE_FULL_INFO fileInfo;
+    if (!openFile(entry, &hFile)) {
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " to stdout E(" << GetLastError() << ")";
+        return 0;
+    }
+    if (!CascGetFileInfo(hFile, CascFileFullInfo, &fileInfo, sizeof(fileInfo), NULL)) {
+        PLOG_ERROR << "Failed to retrieve info of: " << entry.filename << " E(" << GetLastError() << ")";
+        CascCloseFile(hFile);
+        return 0;
+    }
+
+    // size of the payload has to be known before any of it is decoded
+    if (fileInfo.ContentSize == CASC_INVALID_SIZE64) {
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " - content size is unknown";
+        CascCloseFile(hFile);
+        return 0;
+    }
+    uint64_t contentSize = fileInfo.ContentSize;
+    uint64_t frameSize = std::min(seekRange(hFile), contentSize - std::min(contentSize, m_rangeOffset));
+
+    STORAGE_SEARCH_RESULT record;
+    record.filename = entry.filename;
+    memcpy(record.CKey, fileInfo.CKey, sizeof(record.CKey));
+    memcpy(record.EKey, fileInfo.EKey, sizeof(record.EKey));
+    std::string header;
+    if (!appendBinRecord(header, record, frameSize)) {
+        CascCloseFile(hFile);
         return 0;
     }
+    writer.write(header.data(), header.size());
+
+    Md5 md5;
+    size_t fileSize = decodeToWriter(hFile, frameSize, writer, md5);
+    if (fileSize < frameSize) {
+        // keep the stream in sync, consumer can tell the payload is damaged by its CKey
+        PLOG_ERROR << "Failed to extract: " << entry.filename << " - decoded " << fileSize << " of " << frameSize << " bytes, padding with zeros";
+        for (uint64_t padding = frameSize - fileSize; padding > 0;) {
+            size_t available;
+            char* buffer = writer.reserve(available);
+            size_t len = static_cast<size_t>(std::min(padding, static_cast<uint64_t>(available)));
+            memset(buffer, 0, len);
+            if (!writer.commit(len)) break;
+            padding -= len;
+        }
+    }
+
+    if (m_verify) verifyContentKey(hFile, md5, entry.filename);
+    CascCloseFile(hFile);
+
+    return fileSize;
+}
+
+size_t StorageExplorer::decodeToWriter(HANDLE hFile, uint64_t length, StdoutWriter& writer, Md5& md5)
+{
+    size_t fileSize = 0;
+    while (length > 0) {
+        DWORD read = 0;
+        size_t available;
+        char* buffer = writer.reserve(available);
+        DWORD toRead = static_cast<DWORD>(std::min(length, static_cast<uint64_t>(available)));
+        if (!CascReadFile(hFile, buffer, toRead, &read) || read == 0) {
+            break;
+        }
+        ioThrottle.read.consume(read);
+        // hash before commit, as it may hand the buffer over to the pipe
+        if (m_verify) md5.update(buffer, read);
+        if (!writer.commit(read)) {
+            break;
+        }
+        fileSize += read;
+        length -= read;
+    }
 
     return fileSize;
 }
+
+uint64_t StorageExplorer::seekRange(HANDLE hFile)
+{
+    if (m_rangeOffset == 0) {
+        return m_rangeLength;
+    }
+
+    DWORD sizeHigh = 0;
+    DWORD sizeLow = CascGetFileSize(hFile, &sizeHigh);
+    uint64_t size = (static_cast<uint64_t>(sizeHigh) << 32) | sizeLow;
+    if (sizeLow == CASC_INVALID_SIZE || m_rangeOffset >= size) {
+        return 0;
+    }
+
+    LONG offsetHigh = static_cast<LONG>(m_rangeOffset >> 32);
+    if (CascSetFilePointer(hFile, static_cast<LONG>(m_rangeOffset & 0xFFFFFFFF), &offsetHigh, FILE_BEGIN) == CASC_INVALID_POS) {
+        return 0;
+    }
+
+    return std::min(m_rangeLength, size - m_rangeOffset);
+}
+
+bool StorageExplorer::verifyContentKey(HANDLE hFile, Md5& md5, const std::string& storedFilename)
+{
+    BYTE digest[MD5_HASH_SIZE];
+    BYTE ckey[MD5_HASH_SIZE];
+    md5.finish(digest);
+
+    if (!CascGetFileInfo(hFile, CascFileContentKey, ckey, sizeof(ckey), NULL)) {
+        PLOG_ERROR << "Couldn't retrieve CKey of: " << storedFilename << " E(" << GetLastError() << ")";
+        m_verifyFailures++;
+        return false;
+    }
+
+    if (memcmp(digest, ckey, sizeof(ckey)) != 0) {
+        char expected[MD5_HASH_SIZE * 2 + 1];
+        char actual[MD5_HASH_SIZE * 2 + 1];
+        bytesToHex(expected, ckey, sizeof(ckey));
+        bytesToHex(actual, digest, sizeof(digest));
+        PLOG_ERROR << "Verification failed: " << storedFilename << " CKey " << expected << " != MD5 " << actual;
+        m_verifyFailures++;
+        return false;
+    }
+
+    return true;
+}
@@ -6,16 +6,34 @@
 #include <stdio.h>
 #include <fstream>
 #include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
 
 #include "cxxopts.hpp"
 #include "common.hpp"
 #include "util.hpp"
 #include "storage.hpp"
 #include "cascfuse.hpp"
+#include "listing.hpp"
+#include "server.hpp"
+#include "memreport.hpp"
+#include "throttle.hpp"
 #include "common/Common.h"
 
 class StormexContext {
 public:
+    struct {
+        std::string memReportPath;
+        std::string bwLimitSpec;
+        uint64_t readLimit = 0;
+        uint64_t writeLimit = 0;
+        std::string ioPriorityName;
+        SchedPriority ioPriority = SchedPriority::Normal;
+    } m_common;
+
     struct {
         std::string storageSrc;
         std::string listfileSrc;
@@ -24,6 +42,12 @@ public:
     struct {
         bool listFiles;
         bool showDetails;
+        std::string formatName;
+        ListFormat format;
+        std::string sortKey;
+        size_t top;
+        bool summarize;
+        unsigned int summaryDepth;
     } m_list;
 
     struct {
@@ -31,21 +55,54 @@ public:
         bool searchSmartCast;
         std::vector<std::regex> includePatterns;
         std::vector<std::regex> excludePatterns;
+        uint64_t minSize = 0;
+        uint64_t maxSize = UINT64_MAX;
+        std::vector<std::string> ckeyPrefixes;
+        std::vector<std::string> nameTypeNames;
+        std::vector<CASC_NAME_TYPE> nameTypes;
+        std::vector<std::string> extensions;
+        std::vector<std::string> pathPrefixes;
+        std::vector<std::string> globPatterns;
     } m_filters;
 
     struct {
         bool doExtractAll;
         std::vector<std::string> xFilenames;
+        std::string ckeyList;
+        std::string ekeyList;
         std::string outDir;
         bool stdOut;
         bool progress;
         bool dryRun;
+        bool verify;
+        bool verifyOutDir;
+        bool mmap;
+        bool framed;
+        std::string objectStore;
+        bool symlinks;
+        std::string rangeSpec;
+        uint64_t headLength;
+        uint64_t rangeOffset = 0;
+        uint64_t rangeLength = UINT64_MAX;
     } m_extract;
 
     struct {
         std::string mountPoint;
+        CascfsOptions cascfs;
+        std::vector<std::string> buildSpecs;
+        // name and path of each additional storage
+        std::vector<std::pair<std::string, std::string>> builds;
+        std::string mountName;
     } m_mount;
 
+    struct {
+        std::string socketPath;
+    } m_serve;
+
+    struct {
+        std::string baseStorageSrc;
+    } m_diff;
+
     void scanExtraArgs(cxxopts::ParseResult pResult)
     {
         if (pResult.count("in-regex")) {
@@ -83,6 +140,61 @@ private:
 
 StormexContext appCtx;
 
+/**
+ * @brief Parse OFFSET:LEN (or OFFSET: / OFFSET) into its parts, LEN defaults to UINT64_MAX
+ */
+bool parseRange(const std::string& spec, uint64_t& offset, uint64_t& length)
+{
+    char* end;
+    size_t sep = spec.find(':');
+    std::string offsetStr = spec.substr(0, sep);
+    if (offsetStr.empty()) return false;
+    offset = strtoull(offsetStr.c_str(), &end, 10);
+    if (*end != '\0') return false;
+
+    length = UINT64_MAX;
+    if (sep != std::string::npos && sep + 1 < spec.size()) {
+        length = strtoull(spec.c_str() + sep + 1, &end, 10);
+        if (*end != '\0') return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Parse number of bytes with optional K, M or G (binary) suffix
+ */
+bool parseByteSize(const std::string& spec, uint64_t& size)
+{
+    char* end;
+    if (spec.empty()) return false;
+    size = strtoull(spec.c_str(), &end, 10);
+    if (end == spec.c_str()) return false;
+
+    switch (tolower(static_cast<unsigned char>(*end))) {
+        case '\0': return true;
+        case 'k': size <<= 10; break;
+        case 'm': size <<= 20; break;
+        case 'g': size <<= 30; break;
+        default: return false;
+    }
+    return end[1] == '\0';
+}
+
+/**
+ * @brief Parse READ[:WRITE] rates, WRITE defaults to READ
+ */
+bool parseBandwidthLimit(const std::string& spec, uint64_t& readLimit, uint64_t& writeLimit)
+{
+    size_t sep = spec.find(':');
+    if (!parseByteSize(spec.substr(0, sep), readLimit)) return false;
+    if (sep == std::string::npos) {
+        writeLimit = readLimit;
+        return true;
+    }
+    return parseByteSize(spec.substr(sep + 1), writeLimit);
+}
+
 void parseArguments(int argc, char* argv[])
 {
     try {
@@ -100,6 +212,16 @@ void parseArguments(int argc, char* argv[])
             ("h,help", "Print help.")
             ("v,verbose", "Verbose output.", cxxopts::value<bool>())
             ("q,quiet", "Supresses output entirely.", cxxopts::value<bool>())
+            ("mem-report",
+                "Account heap allocations and RSS per phase (open, enumerate, filter, extract..), and print a table of them to stderr on exit. "
+                "When FILE is given, write the report to it as JSON instead.",
+                cxxopts::value<std::string>(appCtx.m_common.memReportPath)->implicit_value("-"), "[FILE]")
+            ("bwlimit",
+                "Limit bytes per second read from the storage and written out (by extraction, mount and server), shared by all threads. "
+                "Accepts K, M and G suffixes, WRITE defaults to READ.",
+                cxxopts::value<std::string>(appCtx.m_common.bwLimitSpec), "[READ[:WRITE]]")
+            ("io-priority", "CPU and I/O scheduling priority: normal, low, idle.",
+                cxxopts::value<std::string>(appCtx.m_common.ioPriorityName)->default_value("normal"), "[PRIORITY]")
             ("version", "Print version.");
 
         options.add_options("Base")
@@ -110,7 +232,16 @@ void parseArguments(int argc, char* argv[])
 
         options.add_options("List")
             ("l,list", "List files inside CASC.", cxxopts::value<bool>(appCtx.m_list.listFiles))
-            ("d,details", "Show details about each file - such as its size.", cxxopts::value<bool>(appCtx.m_list.showDetails));
+            ("d,details", "Show details about each file - such as its size.", cxxopts::value<bool>(appCtx.m_list.showDetails))
+            ("format",
+                "Output format of the list: text, tsv, ndjson, bin. Formats other than text always include name, CKey, EKey and size.",
+                cxxopts::value<std::string>(appCtx.m_list.formatName)->default_value("text"), "[FORMAT]")
+            ("sort", "Sort the list by: size (largest first), name.", cxxopts::value<std::string>(appCtx.m_list.sortKey), "[KEY]")
+            ("top", "Limit the list to first N entries. Implies sorting by size, unless specified otherwise.", cxxopts::value<size_t>(appCtx.m_list.top), "[N]")
+            ("du",
+                "Summarize size of directories up to given depth, instead of listing files. "
+                "Total is printed at the end. Combine with --details to include number of files.",
+                cxxopts::value<unsigned int>(appCtx.m_list.summaryDepth), "[DEPTH]");
 
         options.add_options("Filter")
             ("s,search", "Search for files using a substring.", cxxopts::value<std::vector<std::string>>(appCtx.m_filters.searchPhrase), "[SEARCH...]")
@@ -120,7 +251,21 @@ void parseArguments(int argc, char* argv[])
             ("i,in-regex", "Include files matching regex.", cxxopts::value<std::vector<std::string>>(), "[PATTERN...]")
             ("I,in-iregex", "Include files matching regex case insensitively.", cxxopts::value<std::vector<std::string>>(), "[PATTERN...]")
             ("e,ex-regex", "Exclude files matching regex.", cxxopts::value<std::vector<std::string>>(), "[PATTERN...]")
-            ("E,ex-iregex", "Exclude files matching regex case insensitively.", cxxopts::value<std::vector<std::string>>(), "[PATTERN...]");
+            ("E,ex-iregex", "Exclude files matching regex case insensitively.", cxxopts::value<std::vector<std::string>>(), "[PATTERN...]")
+            ("path",
+                "Include files under given directory. Subtrees outside of it are skipped already during enumeration.",
+                cxxopts::value<std::vector<std::string>>(appCtx.m_filters.pathPrefixes), "[PREFIX...]")
+            ("glob",
+                "Include files whose full path matches glob pattern (case insensitive, '/' and '\\' are equivalent). "
+                "'?' matches single character, '*' any sequence within directory name, '**' any sequence including separators.",
+                cxxopts::value<std::vector<std::string>>(appCtx.m_filters.globPatterns), "[PATTERN...]")
+            ("min-size", "Include files of at least N bytes.", cxxopts::value<uint64_t>(appCtx.m_filters.minSize), "[N]")
+            ("max-size", "Include files of at most N bytes.", cxxopts::value<uint64_t>(appCtx.m_filters.maxSize), "[N]")
+            ("ckey", "Include files whose CKey starts with given hex prefix.", cxxopts::value<std::vector<std::string>>(appCtx.m_filters.ckeyPrefixes), "[PREFIX...]")
+            ("name-type",
+                "Include files by the kind of their name: full, id (FileDataId), ckey, ekey (name is a string representation of the key).",
+                cxxopts::value<std::vector<std::string>>(appCtx.m_filters.nameTypeNames), "[TYPE...]")
+            ("ext", "Include files with given extension (case insensitive).", cxxopts::value<std::vector<std::string>>(appCtx.m_filters.extensions), "[EXT...]");
 
         options.add_options("Extract")
             ("x,extract-all",
@@ -129,21 +274,77 @@ void parseArguments(int argc, char* argv[])
             ("X,extract-file",
                 "Extract file(s) matching exactly.",
                 cxxopts::value<std::vector<std::string>>(appCtx.m_extract.xFilenames), "[FILE...]")
+            ("ckey-list",
+                "Extract files of CKeys listed in FILE (one hex key per line, - for stdin) without enumerating the storage. "
+                "Files are named after their keys.",
+                cxxopts::value<std::string>(appCtx.m_extract.ckeyList), "[FILE]")
+            ("ekey-list", "Same as --ckey-list, for EKeys.", cxxopts::value<std::string>(appCtx.m_extract.ekeyList), "[FILE]")
             ("o,outdir", "Output directory for extracted files.", cxxopts::value<std::string>(appCtx.m_extract.outDir)->default_value("."), "[PATH]")
             ("p,stdout", "Pipe content of a file(s) to stdout instead writing it to the filesystem.", cxxopts::value<bool>(appCtx.m_extract.stdOut))
+            ("framed",
+                "Pipe files to stdout as length-prefixed records: name, CKey, EKey and size (as in --format bin), followed by the content. "
+                "Implies --stdout.",
+                cxxopts::value<bool>(appCtx.m_extract.framed))
             ("P,progress", "Notify about progress during extraction.", cxxopts::value<bool>(appCtx.m_extract.progress))
-            ("n,dry-run", "Simulate extraction process without writing any data to the filesystem.", cxxopts::value<bool>(appCtx.m_extract.dryRun));
+            ("n,dry-run", "Simulate extraction process without writing any data to the filesystem.", cxxopts::value<bool>(appCtx.m_extract.dryRun))
+            ("object-store",
+                "Write content of each unique CKey only once, into given directory shared between extractions (of different builds). "
+                "Files in the output directory become links to these objects - objects already present are not decoded again.",
+                cxxopts::value<std::string>(appCtx.m_extract.objectStore), "[PATH]")
+            ("symlink", "Link files to the object store with symbolic links, instead of hardlinks.", cxxopts::value<bool>(appCtx.m_extract.symlinks))
+            ("range",
+                "Extract only LEN bytes of each file, starting at OFFSET - only the frames covering that part are decoded. "
+                "Without LEN the rest of the file is extracted.",
+                cxxopts::value<std::string>(appCtx.m_extract.rangeSpec), "[OFFSET:LEN]")
+            ("head", "Extract only first N bytes of each file.", cxxopts::value<uint64_t>(appCtx.m_extract.headLength), "[N]")
+            ("mmap",
+                "Decode files straight into memory mapped output, rather than writing them. "
+                "Files which cannot be mapped are written as usual.",
+                cxxopts::value<bool>(appCtx.m_extract.mmap))
+            ("verify", "Compute MD5 of extracted data and compare it with CKey of the file.", cxxopts::value<bool>(appCtx.m_extract.verify))
+            ("verify-outdir",
+                "Instead of extracting, verify files matching search filters that were previously extracted to the output directory. "
+                "Files are hashed in parallel and those missing or not matching their CKey are listed.",
+                cxxopts::value<bool>(appCtx.m_extract.verifyOutDir));
 
         options.add_options("Mount")
             ("m,mount",
-                "Mount CASC as a filesystem", cxxopts::value<std::string>(appCtx.m_mount.mountPoint), "[MOUNTPOINT]");
+                "Mount CASC as a filesystem", cxxopts::value<std::string>(appCtx.m_mount.mountPoint), "[MOUNTPOINT]")
+            ("shard-ckey",
+                "Group files under CKEY directory into subdirectories named after first two characters of the key.",
+                cxxopts::value<bool>(appCtx.m_mount.cascfs.shardCKeys))
+            ("warm",
+                "Once mounted, read files matching glob pattern in the background at idle priority, so first reads don't hit cold storage. "
+                "Pattern without a separator matches names at any depth, matching directory warms up everything under it.",
+                cxxopts::value<std::vector<std::string>>(appCtx.m_mount.cascfs.warmPatterns), "[PATTERN...]")
+            ("warm-threads", "Number of background threads reading files to warm up.",
+                cxxopts::value<unsigned int>(appCtx.m_mount.cascfs.warmThreads)->default_value("2"), "[N]")
+            ("build",
+                "Mount another storage in the same filesystem, under top-level directory NAME. "
+                "Content of equal CKeys is shared between all mounted storages.",
+                cxxopts::value<std::vector<std::string>>(appCtx.m_mount.buildSpecs), "[NAME=PATH...]")
+            ("mount-as",
+                "Name of the top-level directory of the main storage, when mounted along with --build. Defaults to the name of its directory.",
+                cxxopts::value<std::string>(appCtx.m_mount.mountName), "[NAME]");
+
+        options.add_options("Diff")
+            ("diff",
+                "Compare with another storage (such as previous build) - list files added (A), removed (D) or modified (M) since. "
+                "Combined with --extract-all only added and modified files are extracted.",
+                cxxopts::value<std::string>(appCtx.m_diff.baseStorageSrc), "[BASE]");
+
+        options.add_options("Serve")
+            ("serve",
+                "Keep the storage open and serve list, stat, read and extract requests over a Unix socket. "
+                "Search filters limit the set of served files.",
+                cxxopts::value<std::string>(appCtx.m_serve.socketPath), "[SOCKET]");
 
         options.parse_positional({"storage"});
 
         auto result = options.parse(argc, argv);
 
         if (result.count("help")) {
-            std::cerr << options.help({ "Common", "Base", "List", "Filter", "Extract", "Mount" }) << std::endl;
+            std::cerr << options.help({ "Common", "Base", "List", "Filter", "Extract", "Diff", "Mount", "Serve" }) << std::endl;
             exit(0);
         }
 
@@ -174,6 +375,108 @@ void parseArguments(int argc, char* argv[])
             exit(1);
         }
 
+        if (!parseListFormat(appCtx.m_list.formatName, appCtx.m_list.format)) {
+            std::cerr << "unknown list format: " << appCtx.m_list.formatName << std::endl;
+            exit(1);
+        }
+
+        if (!appCtx.m_list.sortKey.empty() && appCtx.m_list.sortKey != "size" && appCtx.m_list.sortKey != "name") {
+            std::cerr << "unknown sort key: " << appCtx.m_list.sortKey << std::endl;
+            exit(1);
+        }
+        if (appCtx.m_list.top && appCtx.m_list.sortKey.empty()) {
+            appCtx.m_list.sortKey = "size";
+        }
+        appCtx.m_list.summarize = result.count("du") > 0;
+
+        for (auto& prefix : appCtx.m_filters.ckeyPrefixes) {
+            stringToLower(prefix);
+            if (prefix.size() > MD5_HASH_SIZE * 2 || prefix.find_first_not_of("0123456789abcdef") != std::string::npos) {
+                std::cerr << "invalid CKey prefix: " << prefix << std::endl;
+                exit(1);
+            }
+        }
+        for (const auto& typeName : appCtx.m_filters.nameTypeNames) {
+            if (typeName == "full") appCtx.m_filters.nameTypes.push_back(CascNameFull);
+            else if (typeName == "id") appCtx.m_filters.nameTypes.push_back(CascNameDataId);
+            else if (typeName == "ckey") appCtx.m_filters.nameTypes.push_back(CascNameCKey);
+            else if (typeName == "ekey") appCtx.m_filters.nameTypes.push_back(CascNameEKey);
+            else {
+                std::cerr << "unknown name type: " << typeName << std::endl;
+                exit(1);
+            }
+        }
+        for (auto& ext : appCtx.m_filters.extensions) {
+            if (ext.size() && ext[0] == '.') ext.erase(0, 1);
+        }
+
+        if (result.count("bwlimit") && !parseBandwidthLimit(appCtx.m_common.bwLimitSpec, appCtx.m_common.readLimit, appCtx.m_common.writeLimit)) {
+            std::cerr << "invalid bandwidth limit: " << appCtx.m_common.bwLimitSpec << std::endl;
+            exit(1);
+        }
+        if (appCtx.m_common.ioPriorityName == "low") appCtx.m_common.ioPriority = SchedPriority::Low;
+        else if (appCtx.m_common.ioPriorityName == "idle") appCtx.m_common.ioPriority = SchedPriority::Idle;
+        else if (appCtx.m_common.ioPriorityName != "normal") {
+            std::cerr << "unknown I/O priority: " << appCtx.m_common.ioPriorityName << std::endl;
+            exit(1);
+        }
+
+        if (appCtx.m_mount.buildSpecs.size()) {
+            if (appCtx.m_mount.mountName.empty()) {
+                std::string storagePath = appCtx.m_base.storageSrc;
+                while (storagePath.size() > 1 && (storagePath.back() == '/' || storagePath.back() == '\\')) storagePath.pop_back();
+                size_t pos = storagePath.find_last_of("/\\");
+                appCtx.m_mount.mountName = pos == std::string::npos ? storagePath : storagePath.substr(pos + 1);
+            }
+            std::vector<std::string> names = { appCtx.m_mount.mountName };
+            for (const auto& spec : appCtx.m_mount.buildSpecs) {
+                size_t sep = spec.find('=');
+                if (sep == std::string::npos || sep == 0 || sep + 1 == spec.size()) {
+                    std::cerr << "invalid build, expected NAME=PATH: " << spec << std::endl;
+                    exit(1);
+                }
+                appCtx.m_mount.builds.emplace_back(spec.substr(0, sep), spec.substr(sep + 1));
+                names.push_back(spec.substr(0, sep));
+            }
+            for (size_t i = 0; i < names.size(); ++i) {
+                if (names[i].empty() || names[i].find_first_of("/\\:") != std::string::npos || names[i] == "." || names[i] == ".." || names[i] == ".stormex") {
+                    std::cerr << "invalid name of mounted storage: " << names[i] << std::endl;
+                    exit(1);
+                }
+                for (size_t j = 0; j < i; ++j) {
+                    if (stringEqualIC(names[i], names[j])) {
+                        std::cerr << "storages mounted under the same name: " << names[i] << " (see --mount-as)" << std::endl;
+                        exit(1);
+                    }
+                }
+            }
+        }
+
+        if (result.count("range") && result.count("head")) {
+            std::cerr << "--range and --head cannot be combined" << std::endl;
+            exit(1);
+        }
+        if (result.count("range") && !parseRange(appCtx.m_extract.rangeSpec, appCtx.m_extract.rangeOffset, appCtx.m_extract.rangeLength)) {
+            std::cerr << "invalid range: " << appCtx.m_extract.rangeSpec << std::endl;
+            exit(1);
+        }
+        if (result.count("head")) {
+            appCtx.m_extract.rangeLength = appCtx.m_extract.headLength;
+        }
+        if (appCtx.m_extract.framed) {
+            appCtx.m_extract.stdOut = true;
+        }
+        if (appCtx.m_extract.objectStore.length() && (appCtx.m_extract.rangeOffset != 0 || appCtx.m_extract.rangeLength != UINT64_MAX)) {
+            std::cerr << "--object-store cannot be combined with --range or --head" << std::endl;
+            exit(1);
+        }
+        if ((result.count("ckey-list") || result.count("ekey-list"))
+            && (result.count("list") || result.count("du") || result.count("extract-all") || result.count("verify-outdir")
+                || result.count("diff") || result.count("serve"))) {
+            std::cerr << "--ckey-list and --ekey-list cannot be combined with -l, --du, -x, --verify-outdir, --diff or --serve" << std::endl;
+            exit(1);
+        }
+
         appCtx.scanExtraArgs(result);
     } catch (const cxxopts::OptionException& e) {
         std::cerr << "error parsing options: " << e.what() << std::endl;
@@ -181,18 +484,58 @@ void parseArguments(int argc, char* argv[])
     }
 }
 
-void extractFilenames(StorageExplorer& stExplorer, const std::vector<std::string>& filesToExtract)
+/**
+ * @brief Location of the file under output directory
+ */
+std::string targetFilePath(const std::string& storedFilename)
+{
+    std::string targetFile = appCtx.m_extract.outDir;
+    if (targetFile.at(targetFile.size() - 1) != '\\' && targetFile.at(targetFile.size() - 1) != '/') {
+        targetFile += PATH_SEP_STR;
+    }
+    targetFile += storedFilename;
+
+    // normalize slashes in the paths received from CASC and force '/'
+    std::replace(targetFile.begin(), targetFile.end(), '\\', '/');
+
+    // replace colon with backslash for compatibility purposes
+    // internally in CASC, colon is used on directories that act as mount points
+    std::replace(targetFile.begin(), targetFile.end(), ':', '/');
+
+    return targetFile;
+}
+
+/**
+ * @brief Extract entries to the output directory, or to stdout
+ *
+ * @return size_t number of files that failed to be written or verified
+ */
+size_t extractEntries(StorageExplorer& stExplorer, const std::vector<STORAGE_SEARCH_RESULT*>& filesToExtract)
 {
+    size_t writeFailures = 0;
+    bool partial = appCtx.m_extract.rangeOffset != 0 || appCtx.m_extract.rangeLength != UINT64_MAX;
+    if (partial && appCtx.m_extract.verify) {
+        PLOG_WARNING << "Verification is not possible when extracting only a part of files, skipping it..";
+    }
+    stExplorer.setVerify(appCtx.m_extract.verify && !appCtx.m_extract.dryRun && !partial);
+    stExplorer.setRange(appCtx.m_extract.rangeOffset, appCtx.m_extract.rangeLength);
+
     PLOG_DEBUG << "Preparing to extract " << filesToExtract.size() << " files..";
     if (appCtx.m_extract.dryRun) {
         PLOG_INFO << "Dry mode is active..";
     }
 
     if (appCtx.m_extract.stdOut) {
-        setvbuf(stdout, NULL, _IONBF, 0);
-        for (const auto& storedFilename : filesToExtract) {
-            stExplorer.extractFileData(storedFilename, stdout);
+        StdoutWriter writer;
+        for (const auto& entry : filesToExtract) {
+            if (appCtx.m_extract.framed) {
+                stExplorer.extractFileFramed(*entry, writer);
+            }
+            else {
+                stExplorer.extractFileData(*entry, writer);
+            }
         }
+        writer.flush();
     }
     else if (!appCtx.m_extract.outDir.empty()) {
         if (!pathExists(appCtx.m_extract.outDir)) {
@@ -202,40 +545,164 @@ void extractFilenames(StorageExplorer& stExplorer, const std::vector<std::string
 
         PLOG_DEBUG << "Output directory set to: " << appCtx.m_extract.outDir;
 
-        for (const auto& storedFilename : filesToExtract) {
-            std::string targetFile = appCtx.m_extract.outDir;
-            if (targetFile.at(targetFile.size() - 1) != '\\' && targetFile.at(targetFile.size() - 1) != '/') {
-                targetFile += PATH_SEP_STR;
+        ExtractPipeline pipeline;
+        std::unique_ptr<ObjectStore> store;
+        if (appCtx.m_extract.objectStore.length() && !appCtx.m_extract.dryRun) {
+            store.reset(new ObjectStore(appCtx.m_extract.objectStore, appCtx.m_extract.symlinks));
+            if (!store->open()) {
+                exit(-3);
             }
-            targetFile += storedFilename;
+        }
+        for (const auto& entry : filesToExtract) {
+            std::string targetFile = targetFilePath(entry->filename);
 
             if (appCtx.m_extract.progress) {
                 // TODO: display progress
             }
 
-            PLOG_INFO << "Extracting file " << storedFilename;
+            PLOG_INFO << "Extracting file " << entry->filename;
             size_t fileSize = 0;
             if (!appCtx.m_extract.dryRun) {
-                // normalize slashes in the paths received from CASC and force '/'
-                std::replace(targetFile.begin(), targetFile.end(), '\\', '/');
+                if (store) {
+                    fileSize = stExplorer.extractFileToStore(*entry, targetFile, *store, pipeline);
+                }
+                else if (appCtx.m_extract.mmap) {
+                    fileSize = stExplorer.extractFileToMapping(*entry, targetFile);
+                }
+                else {
+                    fileSize = stExplorer.extractFileToPath(*entry, targetFile, pipeline);
+                }
+                PLOG_DEBUG << "Decoded " << formatFileSize(fileSize) << " to " << targetFile;
+            }
+            else {
+            }
+        }
 
-                // replace colon with backslash for compatibility purposes
-                // internally in CASC, colon is used on directories that act as mount points
-                std::replace(targetFile.begin(), targetFile.end(), ':', '/');
+        writeFailures = pipeline.drain();
+        if (writeFailures) {
+            PLOG_ERROR << "Files that failed to be written: " << writeFailures;
+        }
+        if (store) {
+            for (const auto& failedPath : pipeline.takeFailedRenames()) {
+                store->discard(failedPath);
+            }
+            PLOG_INFO << "Objects added to the store: " << store->getAdded() << ", reused: " << store->getReused();
+        }
+    }
+
+    if (stExplorer.getVerifyFailures()) {
+        PLOG_ERROR << "Files that failed verification: " << stExplorer.getVerifyFailures();
+    }
+
+    return writeFailures + stExplorer.getVerifyFailures();
+}
+
+/**
+ * @brief Hash files previously extracted to the output directory and compare them with their CKey
+ *
+ * Files are distributed over a pool of threads, each reading with its own buffer.
+ * Missing and mismatching files are printed to stdout, in the order of entries.
+ *
+ * @param entries
+ * @return size_t number of files that failed verification
+ */
+size_t verifyOutputDirectory(const std::vector<STORAGE_SEARCH_RESULT*>& entries)
+{
+    enum : char { VerifyOk, VerifyMissing, VerifyMismatch, VerifyUnknownKey };
+    std::vector<char> results(entries.size(), VerifyOk);
+    std::atomic<size_t> nextEntry(0);
 
-                fileSize = stExplorer.extractFileToPath(storedFilename, targetFile);
-                PLOG_DEBUG << "Written " << formatFileSize(fileSize) << " to " << targetFile;
+    auto worker = [&]() {
+        std::vector<char> buffer(1024 * 1024);
+        unsigned char digest[Md5::DIGEST_SIZE];
+        size_t i;
+        while ((i = nextEntry.fetch_add(1, std::memory_order_relaxed)) < entries.size()) {
+            if (!entries[i]->hasCKey) {
+                // nothing to compare against, only presence is checked
+                FILE* fileStream = fopen(targetFilePath(entries[i]->filename).c_str(), "rb");
+                results[i] = fileStream != NULL ? VerifyUnknownKey : VerifyMissing;
+                if (fileStream != NULL) fclose(fileStream);
             }
-            else {
+            else if (!md5File(targetFilePath(entries[i]->filename), digest, buffer)) {
+                results[i] = VerifyMissing;
+            }
+            else if (memcmp(digest, entries[i]->CKey, sizeof(digest)) != 0) {
+                results[i] = VerifyMismatch;
             }
         }
+    };
+
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max<size_t>(1, entries.size()));
+    PLOG_INFO << "Verifying " << entries.size() << " files using " << threadCount << " threads..";
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
     }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    size_t failures = 0;
+    size_t unverified = 0;
+    StdoutWriter writer;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const char* status;
+        switch (results[i]) {
+            case VerifyOk: continue;
+            case VerifyMissing: status = "MISSING\t"; failures++; break;
+            case VerifyMismatch: status = "MISMATCH\t"; failures++; break;
+            default: status = "UNVERIFIED\t"; unverified++; break;
+        }
+
+        writer.write(status, strlen(status));
+        writer.write(entries[i]->filename.data(), entries[i]->filename.size());
+        writer.write("\n", 1);
+    }
+    writer.flush();
+
+    if (unverified) {
+        PLOG_WARNING << "Files without known CKey, not verified: " << unverified;
+    }
+    if (failures) {
+        PLOG_ERROR << "Files that failed verification: " << failures << " of " << entries.size();
+    }
+    else {
+        PLOG_INFO << "All " << entries.size() - unverified << " files verified";
+    }
+
+    return failures;
 }
 
-bool searchRegexMulti(const std::string& filename, const std::vector<std::regex>& patterns)
+/**
+ * @brief Single check of the filters, along with relative cost of its evaluation
+ */
+struct FilterPredicate
+{
+    const char* name;
+    double cost;
+    std::function<bool(const STORAGE_SEARCH_RESULT&)> test;
+    // expected cost of rejecting an entry with this predicate - assigned by planFilterPredicates()
+    double rank;
+};
+
+/**
+ * @brief Check whether filename has one of given extensions, case insensitively
+ */
+bool hasExtension(const std::string& filename, const std::vector<std::string>& extensions)
 {
-    for (const auto& current : patterns) {
-        if (regex_search(filename, current)) {
+    size_t dot = filename.find_last_of(".\\:");
+    if (dot == std::string::npos || filename[dot] != '.') {
+        return false;
+    }
+
+    size_t extLen = filename.size() - dot - 1;
+    for (const auto& ext : extensions) {
+        if (ext.size() == extLen && std::equal(ext.begin(), ext.end(), filename.begin() + dot + 1, [](char a, char b) {
+            return tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b));
+        })) {
             return true;
         }
     }
@@ -243,28 +710,252 @@ bool searchRegexMulti(const std::string& filename, const std::vector<std::regex>
     return false;
 }
 
+std::vector<FilterPredicate> buildFilterPredicates()
+{
+    const auto& filters = appCtx.m_filters;
+    std::vector<FilterPredicate> predicates;
+
+    if (filters.pathPrefixes.size() || filters.globPatterns.size()) {
+        predicates.push_back(FilterPredicate{ "path", 2, [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            for (const auto& prefix : filters.pathPrefixes) {
+                if (pathHasPrefix(entry.filename, prefix)) return true;
+            }
+            for (const auto& pattern : filters.globPatterns) {
+                if (globMatch(pattern, entry.filename)) return true;
+            }
+            return false;
+        }, 0 });
+    }
+    if (filters.minSize > 0 || filters.maxSize != UINT64_MAX) {
+        predicates.push_back(FilterPredicate{ "size", 1, [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            return entry.fileSize >= filters.minSize && entry.fileSize <= filters.maxSize;
+        }, 0 });
+    }
+    if (filters.nameTypes.size()) {
+        predicates.push_back(FilterPredicate{ "name-type", 1, [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            return std::find(filters.nameTypes.begin(), filters.nameTypes.end(), entry.nameType) != filters.nameTypes.end();
+        }, 0 });
+    }
+    if (filters.ckeyPrefixes.size()) {
+        predicates.push_back(FilterPredicate{ "ckey", 4, [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            char ckeyHex[MD5_HASH_SIZE * 2 + 1];
+            bytesToHex(ckeyHex, entry.CKey, sizeof(entry.CKey));
+            for (const auto& prefix : filters.ckeyPrefixes) {
+                if (strncmp(ckeyHex, prefix.c_str(), prefix.size()) == 0) return true;
+            }
+            return false;
+        }, 0 });
+    }
+    if (filters.extensions.size()) {
+        predicates.push_back(FilterPredicate{ "ext", 4, [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            return hasExtension(entry.filename, filters.extensions);
+        }, 0 });
+    }
+    if (filters.searchPhrase.size()) {
+        predicates.push_back(FilterPredicate{ "search", 16.0 * filters.searchPhrase.size(), [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            for (const auto& needle : filters.searchPhrase) {
+                if (stringFindIC(entry.filename, needle)) return true;
+            }
+            return false;
+        }, 0 });
+    }
+    if (filters.includePatterns.size()) {
+        predicates.push_back(FilterPredicate{ "in-regex", 256.0 * filters.includePatterns.size(), [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            return searchRegexMulti(entry.filename, filters.includePatterns);
+        }, 0 });
+    }
+    if (filters.excludePatterns.size()) {
+        predicates.push_back(FilterPredicate{ "ex-regex", 256.0 * filters.excludePatterns.size(), [&filters](const STORAGE_SEARCH_RESULT& entry) {
+            return !searchRegexMulti(entry.filename, filters.excludePatterns);
+        }, 0 });
+    }
+
+    return predicates;
+}
+
+/**
+ * @brief Order predicates so the ones cheapest per rejected entry are evaluated first
+ *
+ * Rejection rate of each predicate is measured on an evenly spaced sample of entries, and predicates are sorted
+ * by cost / rejection rate - the optimal order for independent checks combined with AND.
+ */
+void planFilterPredicates(std::vector<FilterPredicate>& predicates, const std::vector<STORAGE_SEARCH_RESULT*>& entries)
+{
+    static const size_t SAMPLE_SIZE = 512;
+    size_t step = std::max<size_t>(1, entries.size() / SAMPLE_SIZE);
+
+    for (auto& predicate : predicates) {
+        size_t sampled = 0;
+        size_t rejected = 0;
+        for (size_t i = 0; i < entries.size(); i += step) {
+            sampled++;
+            if (!predicate.test(*entries[i])) rejected++;
+        }
+        // predicate which rejected nothing from the sample is assumed to reject less than one entry of it
+        double rejectRate = rejected ? static_cast<double>(rejected) / sampled : 1.0 / (sampled + 1);
+        predicate.rank = predicate.cost / rejectRate;
+    }
+
+    std::stable_sort(predicates.begin(), predicates.end(), [](const FilterPredicate& a, const FilterPredicate& b) {
+        return a.rank < b.rank;
+    });
+
+    for (const auto& predicate : predicates) {
+        PLOG_DEBUG << "Filter " << predicate.name << " rank " << predicate.rank;
+    }
+}
+
 std::vector<STORAGE_SEARCH_RESULT*> filterFiles(const std::vector<STORAGE_SEARCH_RESULT*>& inputList)
 {
-    std::vector<STORAGE_SEARCH_RESULT*> filteredList;
+    auto predicates = buildFilterPredicates();
+    if (predicates.empty()) {
+        return inputList;
+    }
 
+    PLOG_INFO << "Filtering list..";
+    planFilterPredicates(predicates, inputList);
+
+    std::vector<STORAGE_SEARCH_RESULT*> filteredList;
     for (const auto& entry : inputList) {
-        if (appCtx.m_filters.searchPhrase.size()) {
-            bool c = false;
-            for (const auto& needle : appCtx.m_filters.searchPhrase) {
-                c = stringFindIC(entry->filename, needle);
-                if (c) break;
+        bool accepted = true;
+        for (const auto& predicate : predicates) {
+            if (!predicate.test(*entry)) {
+                accepted = false;
+                break;
             }
-            if (!c) continue;
         }
-
-        if (appCtx.m_filters.includePatterns.size() && !searchRegexMulti(entry->filename, appCtx.m_filters.includePatterns)) continue;
-        if (appCtx.m_filters.excludePatterns.size() && searchRegexMulti(entry->filename, appCtx.m_filters.excludePatterns)) continue;
-        filteredList.push_back(entry);
+        if (accepted) filteredList.push_back(entry);
     }
 
     return filteredList;
 }
 
+template <typename T, typename Compare>
+void sortListTop(std::vector<T>& items, Compare compare)
+{
+    if (appCtx.m_list.top && appCtx.m_list.top < items.size()) {
+        std::partial_sort(items.begin(), items.begin() + appCtx.m_list.top, items.end(), compare);
+        items.resize(appCtx.m_list.top);
+    }
+    else {
+        std::sort(items.begin(), items.end(), compare);
+    }
+}
+
+/**
+ * @brief Sort items by appCtx.m_list.sortKey, and trim them to appCtx.m_list.top
+ *
+ * When only top entries are requested, they're selected with a partial (heap based) sort,
+ * rather than sorting the whole list.
+ */
+template <typename T, typename GetName, typename GetSize>
+void sortList(std::vector<T>& items, GetName getName, GetSize getSize)
+{
+    if (appCtx.m_list.sortKey.empty()) {
+        if (appCtx.m_list.top && appCtx.m_list.top < items.size()) {
+            items.resize(appCtx.m_list.top);
+        }
+        return;
+    }
+
+    if (appCtx.m_list.sortKey == "size") {
+        sortListTop(items, [&](const T& a, const T& b) {
+            if (getSize(a) != getSize(b)) return getSize(a) > getSize(b);
+            return getName(a) < getName(b);
+        });
+    }
+    else {
+        sortListTop(items, [&](const T& a, const T& b) {
+            return getName(a) < getName(b);
+        });
+    }
+}
+
+/**
+ * @brief Sum up sizes of files per directory, in a single pass over the list
+ *
+ * @param entries
+ * @param maxDepth directories nested deeper than this are accounted to their ancestor at that depth
+ * @param total [out] sum of all entries
+ * @return std::vector<DirectorySummary> in order of first appearance
+ */
+std::vector<DirectorySummary> summarizeDirectories(const std::vector<STORAGE_SEARCH_RESULT*>& entries, unsigned int maxDepth, DirectorySummary& total)
+{
+    std::vector<DirectorySummary> summaries;
+    std::unordered_map<std::string, size_t> summaryIndex;
+    // reused for lookups, to avoid allocating per file
+    std::string prefix;
+
+    total = DirectorySummary{ ".", 0, 0 };
+    for (const auto& entry : entries) {
+        total.size += entry->fileSize;
+        total.files++;
+
+        const std::string& filename = entry->filename;
+        size_t pos = 0;
+        for (unsigned int depth = 0; depth < maxDepth; ++depth) {
+            pos = filename.find_first_of(":\\", pos);
+            if (pos == std::string::npos) break;
+
+            prefix.assign(filename, 0, pos);
+            auto it = summaryIndex.find(prefix);
+            if (it == summaryIndex.end()) {
+                it = summaryIndex.emplace(prefix, summaries.size()).first;
+                summaries.push_back(DirectorySummary{ prefix, 0, 0 });
+            }
+            summaries[it->second].size += entry->fileSize;
+            summaries[it->second].files++;
+            ++pos;
+        }
+    }
+
+    return summaries;
+}
+
+/**
+ * @brief Join two lists by filename (case insensitively) and compare their CKeys
+ *
+ * @param baseEntries older state
+ * @param entries newer state
+ * @return std::vector<FileChange> added and modified files in order of entries, followed by removed
+ */
+std::vector<FileChange> diffFiles(const std::vector<STORAGE_SEARCH_RESULT*>& baseEntries, const std::vector<STORAGE_SEARCH_RESULT*>& entries)
+{
+    std::vector<FileChange> changes;
+    // filename -> position in baseEntries
+    std::unordered_map<std::string, size_t> baseIndex;
+    baseIndex.reserve(baseEntries.size());
+    for (size_t i = 0; i < baseEntries.size(); ++i) {
+        baseIndex[stringToLowerCopy(baseEntries[i]->filename)] = i;
+    }
+    std::vector<bool> baseMatched(baseEntries.size(), false);
+
+    // reused for lookups, to avoid allocating per file
+    std::string key;
+    for (const auto& entry : entries) {
+        key = entry->filename;
+        stringToLower(key);
+        auto it = baseIndex.find(key);
+        if (it == baseIndex.end()) {
+            changes.push_back(FileChange{ DiffStatus::Added, entry });
+            continue;
+        }
+
+        baseMatched[it->second] = true;
+        if (memcmp(baseEntries[it->second]->CKey, entry->CKey, sizeof(entry->CKey)) != 0) {
+            changes.push_back(FileChange{ DiffStatus::Changed, entry });
+        }
+    }
+
+    for (size_t i = 0; i < baseEntries.size(); ++i) {
+        if (!baseMatched[i]) {
+            changes.push_back(FileChange{ DiffStatus::Removed, baseEntries[i] });
+        }
+    }
+
+    return changes;
+}
+
 std::vector<std::string> readListFile(const std::string& filename)
 {
     std::vector<std::string> filelist;
@@ -280,31 +971,139 @@ std::vector<std::string> readListFile(const std::string& filename)
     return filelist;
 }
 
+/**
+ * @brief Wildcard mask for CascLib enumeration, derived from --path and --glob filters
+ *
+ * It consists of the literal part shared by all of them, so names outside of it are rejected by CascLib
+ * before any record is created - CascLib still walks all of them though. Separators are replaced with '?' as the storage may use any of them (such as ':').
+ * Mask only narrows the enumeration, exact matching is left to the filter.
+ */
+std::string enumerationMask()
+{
+    const auto& filters = appCtx.m_filters;
+    std::vector<std::string> literals(filters.pathPrefixes);
+    for (const auto& pattern : filters.globPatterns) {
+        literals.push_back(globLiteralPrefix(pattern));
+    }
+    if (literals.empty()) {
+        return "*";
+    }
+
+    for (auto& literal : literals) {
+        std::replace_if(literal.begin(), literal.end(), [](char ch) { return ch == '/' || ch == '\\' || ch == ':'; }, '?');
+    }
+
+    std::string mask = literals[0];
+    for (const auto& literal : literals) {
+        size_t len = 0;
+        while (len < mask.size() && len < literal.size() && tolower(static_cast<unsigned char>(mask[len])) == tolower(static_cast<unsigned char>(literal[len]))) {
+            ++len;
+        }
+        mask.resize(len);
+    }
+
+    return mask + "*";
+}
+
+/**
+ * @brief Read newline delimited hex keys into entries opened by them
+ *
+ * @param ekeys whether keys are EKeys rather than CKeys
+ * @return false if the list cannot be read
+ */
+bool readKeyList(const std::string& path, bool ekeys, std::vector<STORAGE_SEARCH_RESULT*>& entries)
+{
+    std::ifstream ifs;
+    if (path != "-") {
+        ifs.open(path, std::ifstream::in);
+        if (!ifs.is_open()) {
+            PLOG_FATAL << "Failed to open key list: " << path;
+            return false;
+        }
+    }
+    std::istream& input = path != "-" ? static_cast<std::istream&>(ifs) : std::cin;
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(input, line)) {
+        ++lineNumber;
+        size_t end = line.find_last_not_of(" \t\r");
+        line.resize(end == std::string::npos ? 0 : end + 1);
+        if (line.empty()) continue;
+
+        auto entry = new STORAGE_SEARCH_RESULT();
+        BYTE* key = ekeys ? entry->EKey : entry->CKey;
+        if (!hexToBytes(key, line.c_str(), MD5_HASH_SIZE)) {
+            PLOG_ERROR << "Invalid key at " << path << ":" << lineNumber << ": " << line;
+            delete entry;
+            continue;
+        }
+        stringToLower(line);
+        entry->filename = line;
+        entry->fileAvailable = 1;
+        entry->hasCKey = !ekeys;
+        entry->hasEKey = ekeys;
+        entry->nameType = ekeys ? CascNameEKey : CascNameCKey;
+        entries.push_back(entry);
+    }
+
+    return true;
+}
+
 std::vector<STORAGE_SEARCH_RESULT*> enumerateFiles(StorageExplorer& stExplorer)
 {
-    PLOG_INFO << "Enumerating all files in storage..";
+    std::string mask = enumerationMask();
+    PLOG_INFO << "Enumerating files in storage matching " << mask << "..";
+    memReport.beginPhase("enumerate");
     std::vector<STORAGE_SEARCH_RESULT*> inputList;
-    if (!stExplorer.enumerateFiles(inputList)) {
+    if (!stExplorer.enumerateFiles(inputList, mask)) {
         return inputList;
     }
-    auto filteredList = inputList;
-
-    if (appCtx.m_filters.searchPhrase.size() || appCtx.m_filters.includePatterns.size() || appCtx.m_filters.excludePatterns.size()) {
-        PLOG_INFO << "Filtering list..";
-        filteredList = filterFiles(inputList);
-    }
+    memReport.beginPhase("filter");
+    auto filteredList = filterFiles(inputList);
 
     PLOG_DEBUG << "list count " << inputList.size() << " : " << filteredList.size();
     return filteredList;
 }
 
+/**
+ * @brief Called on exit, so that the report is written regardless of which path has ended the process
+ */
+void writeMemoryReport()
+{
+    memReport.endPhase();
+    if (appCtx.m_common.memReportPath == "-") {
+        memReport.writeText(std::cerr);
+        return;
+    }
+    std::ofstream ofs(appCtx.m_common.memReportPath, std::ofstream::out | std::ofstream::trunc);
+    if (!ofs.is_open()) {
+        std::cerr << "failed to write memory report to " << appCtx.m_common.memReportPath << std::endl;
+        return;
+    }
+    memReport.writeJson(ofs);
+}
+
 int main(int argc, char* argv[])
 {
     parseArguments(argc, argv);
 
+    if (appCtx.m_common.memReportPath.length()) {
+        MemoryReport::enable();
+        atexit(writeMemoryReport);
+    }
+
+    // before any threads are started, so they all inherit the priority and see the limits
+    if (!setThreadPriority(appCtx.m_common.ioPriority)) {
+        PLOG_WARNING << "Couldn't set I/O priority to " << appCtx.m_common.ioPriorityName;
+    }
+    ioThrottle.read.setRate(appCtx.m_common.readLimit);
+    ioThrottle.write.setRate(appCtx.m_common.writeLimit);
+
     StorageExplorer stExplorer;
     int tmp;
 
+    memReport.beginPhase("open");
     LOG_DEBUG << "Opening storage..";
     if ((tmp = stExplorer.openStorage(appCtx.m_base.storageSrc)) != 0) {
         PLOG_FATAL << "Failed to open the storage: " << appCtx.m_base.storageSrc << " E(" << tmp << ")";
@@ -312,41 +1111,123 @@ int main(int argc, char* argv[])
     }
     PLOG_INFO << "Storage opened " << static_cast<void*>(stExplorer.getHandle());
 
+    size_t extractFailures = 0;
     try {
         if (appCtx.m_mount.mountPoint.length()) {
-            return cascfs_mount(appCtx.m_mount.mountPoint, stExplorer.getHandle());
+            // with more than one storage, each gets its own top-level directory
+            std::vector<CascfsStorage> storages;
+            storages.push_back(CascfsStorage{ appCtx.m_mount.builds.size() ? appCtx.m_mount.mountName : "", stExplorer.getHandle() });
+            std::vector<std::unique_ptr<StorageExplorer>> buildExplorers;
+            for (const auto& build : appCtx.m_mount.builds) {
+                buildExplorers.emplace_back(new StorageExplorer());
+                if ((tmp = buildExplorers.back()->openStorage(build.second)) != 0) {
+                    PLOG_FATAL << "Failed to open the storage: " << build.second << " E(" << tmp << ")";
+                    exit(-1);
+                }
+                storages.push_back(CascfsStorage{ build.first, buildExplorers.back()->getHandle() });
+            }
+            return cascfs_mount(appCtx.m_mount.mountPoint, storages, appCtx.m_mount.cascfs);
+        }
+
+        // -X comes after every other mode, as it always did - the files are extracted only when nothing else is asked for
+        bool otherMode = appCtx.m_serve.socketPath.length() || appCtx.m_diff.baseStorageSrc.length() || appCtx.m_list.summarize
+            || appCtx.m_list.listFiles || appCtx.m_extract.verifyOutDir || appCtx.m_extract.doExtractAll;
+        if (appCtx.m_extract.ckeyList.length() || appCtx.m_extract.ekeyList.length() || (appCtx.m_extract.xFilenames.size() && !otherMode)) {
+            // files given explicitly are opened directly - by key, or by name resolved through the root handler
+            std::vector<STORAGE_SEARCH_RESULT*> fList;
+            if (appCtx.m_extract.ckeyList.length() && !readKeyList(appCtx.m_extract.ckeyList, false, fList)) {
+                exit(1);
+            }
+            if (appCtx.m_extract.ekeyList.length() && !readKeyList(appCtx.m_extract.ekeyList, true, fList)) {
+                exit(1);
+            }
+            for (auto& item : appCtx.m_extract.xFilenames) {
+                // force backslashes regardless of the platform
+                // that's the expected output from CASC anyway, and it'll get normalized later
+                std::replace(item.begin(), item.end(), '/', '\\');
+                fList.push_back(new STORAGE_SEARCH_RESULT());
+                fList.back()->filename = item;
+                fList.back()->nameType = CascNameFull;
+            }
+            memReport.beginPhase("extract");
+            return extractEntries(stExplorer, fList) ? 2 : 0;
         }
 
         auto fResults = enumerateFiles(stExplorer);
 
-        if (appCtx.m_list.listFiles) {
-            for (const auto& entry : fResults) {
-                char keyBuff[MD5_STRING_SIZE + 1];
-                std::string tmps;
-                if (appCtx.m_list.showDetails) {
-                    tmps = formatFileSize(entry->fileSize);
-                    std::cout << std::setfill(' ') << std::setw(8) << tmps << "  ";
-                    formatBytes(std::cout, entry->CKey, sizeof(entry->CKey), false);
-                    std::cout << "  ";
+        if (appCtx.m_serve.socketPath.length()) {
+            memReport.beginPhase("serve");
+            StorageServer server(stExplorer, fResults, appCtx.m_extract.outDir);
+            return server.serve(appCtx.m_serve.socketPath);
+        }
+
+        if (appCtx.m_diff.baseStorageSrc.length()) {
+            StorageExplorer baseExplorer;
+            if ((tmp = baseExplorer.openStorage(appCtx.m_diff.baseStorageSrc)) != 0) {
+                PLOG_FATAL << "Failed to open the storage: " << appCtx.m_diff.baseStorageSrc << " E(" << tmp << ")";
+                exit(-1);
+            }
+            auto baseResults = enumerateFiles(baseExplorer);
+            memReport.beginPhase("diff");
+            auto changes = diffFiles(baseResults, fResults);
+            PLOG_INFO << "Changed files: " << changes.size();
+
+            if (appCtx.m_extract.doExtractAll) {
+                std::vector<STORAGE_SEARCH_RESULT*> fList;
+                for (const auto& change : changes) {
+                    if (change.status == DiffStatus::Removed) continue;
+                    fList.push_back(change.entry);
+                }
+                memReport.beginPhase("extract");
+                extractFailures = extractEntries(stExplorer, fList);
+            }
+            else {
+                StdoutWriter writer;
+                ListingWriter listing(writer, appCtx.m_list.format, appCtx.m_list.showDetails);
+                for (const auto& change : changes) {
+                    listing.write(change);
                 }
-                std::cout << entry->filename;
-                std::cout << std::endl;
+                writer.flush();
             }
         }
-        else if (appCtx.m_extract.doExtractAll) {
-            std::vector<std::string> fList;
-            for (const auto& item : fResults) {
-                fList.push_back(item->filename);
+        else if (appCtx.m_list.summarize) {
+            memReport.beginPhase("list");
+            DirectorySummary total;
+            auto summaries = summarizeDirectories(fResults, appCtx.m_list.summaryDepth, total);
+            sortList(summaries,
+                [](const DirectorySummary& item) -> const std::string& { return item.name; },
+                [](const DirectorySummary& item) { return item.size; }
+            );
+
+            StdoutWriter writer;
+            ListingWriter listing(writer, appCtx.m_list.format, appCtx.m_list.showDetails);
+            for (const auto& summary : summaries) {
+                listing.write(summary);
             }
-            extractFilenames(stExplorer, fList);
+            listing.write(total);
+            writer.flush();
         }
-        else if (appCtx.m_extract.xFilenames.size()) {
-            for (auto& item : appCtx.m_extract.xFilenames) {
-                // force backslashes regardless of the platform
-                // that's the expected output from CASC anyway, and it'll get normalized later
-                std::replace(item.begin(), item.end(), '/', '\\');
+        else if (appCtx.m_list.listFiles) {
+            memReport.beginPhase("list");
+            sortList(fResults,
+                [](const STORAGE_SEARCH_RESULT* item) -> const std::string& { return item->filename; },
+                [](const STORAGE_SEARCH_RESULT* item) { return item->fileSize; }
+            );
+
+            StdoutWriter writer;
+            ListingWriter listing(writer, appCtx.m_list.format, appCtx.m_list.showDetails);
+            for (const auto& entry : fResults) {
+                listing.write(*entry);
             }
-            extractFilenames(stExplorer, appCtx.m_extract.xFilenames);
+            writer.flush();
+        }
+        else if (appCtx.m_extract.verifyOutDir) {
+            memReport.beginPhase("verify");
+            return verifyOutputDirectory(fResults) ? 2 : 0;
+        }
+        else if (appCtx.m_extract.doExtractAll) {
+            memReport.beginPhase("extract");
+            extractFailures = extractEntries(stExplorer, fResults);
         }
     } catch (const std::exception& e) {
         stExplorer.closeStorage();
@@ -354,5 +1235,5 @@ int main(int argc, char* argv[])
         throw;
     }
 
-    return 0;
+    return extractFailures ? 2 : 0;
 }
@@ -0,0 +1,40 @@
+#include <algorithm>
+#include <thread>
+
+#include "throttle.hpp"
+
+// burst allowance, in seconds worth of the rate
+static const double BUCKET_BURST_TIME = 0.125;
+// but at least the largest single transfer (stdout buffer) - a thread alternating between reads and writes
+// would otherwise pay for both, instead of refilling one bucket while waiting for the other
+static const double BUCKET_MIN_BURST = 2 * 1024 * 1024;
+
+IoThrottle ioThrottle;
+
+void TokenBucket::setRate(uint64_t bytesPerSecond)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_rate = static_cast<double>(bytesPerSecond);
+    m_capacity = std::max(m_rate * BUCKET_BURST_TIME, BUCKET_MIN_BURST);
+    m_tokens = m_capacity;
+    m_lastRefill = std::chrono::steady_clock::now();
+}
+
+void TokenBucket::consumeLimited(uint64_t bytes)
+{
+    double debt;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - m_lastRefill).count();
+        m_lastRefill = now;
+        m_tokens = std::min(m_capacity, m_tokens + elapsed * m_rate);
+        m_tokens -= static_cast<double>(bytes);
+        debt = -m_tokens;
+    }
+
+    // later callers see the debt as well, and wait for their own share on top of it
+    if (debt > 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(debt / m_rate));
+    }
+}
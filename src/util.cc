@@ -7,6 +7,17 @@
 #include <sys/types.h>
 #include <regex>
 #include <cctype>
+#include <string.h>
+#ifdef __linux__
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <sys/resource.h>
+#elif defined(__APPLE__)
+    #include <sys/resource.h>
+#elif defined(WIN32)
+    #include <windows.h>
+#endif
 #include "util.hpp"
 #include "common.hpp"
 
@@ -50,39 +61,47 @@ int ensureDirExists(std::string strDestName)
     return 0;
 }
 
-template <typename T>
-std::string valueToString(T num)
-{
-    std::ostringstream convert;
-    convert << std::setprecision(8) << num;
-    return convert.str();
-}
-
-static double roundOff(double n)
+std::string formatFileSize(size_t size)
 {
-    double d = n * 10.0;
-    int i = d + 0.5;
-    d = (float)i / 10.0;
-    return d;
+    char buff[32];
+    size_t len = formatFileSize(buff, size);
+    return std::string(buff, len);
 }
 
-std::string formatFileSize(size_t size)
+size_t formatFileSize(char *out, size_t size)
 {
-    static const char *SIZES[] = { "B", "K", "M", "G" };
+    static const char SIZES[] = { 'B', 'K', 'M', 'G' };
     int div = 0;
     size_t rem = 0;
 
-    while (size >= 1024 && div < (sizeof SIZES / sizeof *SIZES)) {
+    while (size >= 1024 && div < (sizeof SIZES / sizeof *SIZES) - 1) {
         rem = (size % 1024);
         div++;
         size /= 1024;
     }
 
+    // rounded off to a single decimal place
     double size_d = (float)size + (float)rem / 1024.0;
-    std::string result = valueToString(roundOff(size_d)) + SIZES[div];
-    std::replace(result.begin(), result.end(), '.', ',');
+    unsigned long tenths = static_cast<unsigned long>(size_d * 10.0 + 0.5);
 
-    return result;
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long whole = tenths / 10;
+    do {
+        *--p = '0' + (whole % 10);
+        whole /= 10;
+    } while (whole);
+
+    size_t len = digits + sizeof(digits) - p;
+    memcpy(out, p, len);
+    if (tenths % 10) {
+        out[len++] = ',';
+        out[len++] = '0' + (tenths % 10);
+    }
+    out[len++] = SIZES[div];
+    out[len] = '\0';
+
+    return len;
 }
 
 bool stringFindIC(const std::string& strHaystack, const std::string& strNeedle)
@@ -103,6 +122,79 @@ bool stringEqualIC(const std::string& str1, const std::string& str2)
     });
 }
 
+bool searchRegexMulti(const std::string& filename, const std::vector<std::regex>& patterns)
+{
+    for (const auto& current : patterns) {
+        if (regex_search(filename, current)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline bool isPathSep(char ch)
+{
+    // colon separates mount points (such as archives) within CASC paths
+    return ch == '\\' || ch == '/' || ch == ':';
+}
+
+static inline bool pathCharsEqual(char ch1, char ch2)
+{
+    if (isPathSep(ch1)) return isPathSep(ch2);
+    return std::tolower(static_cast<unsigned char>(ch1)) == std::tolower(static_cast<unsigned char>(ch2));
+}
+
+bool pathHasPrefix(const std::string& path, const std::string& prefix)
+{
+    size_t len = prefix.size();
+    while (len && isPathSep(prefix[len - 1])) --len;
+
+    if (path.size() < len) return false;
+    for (size_t i = 0; i < len; ++i) {
+        if (!pathCharsEqual(path[i], prefix[i])) return false;
+    }
+
+    return len == 0 || path.size() == len || isPathSep(path[len]);
+}
+
+static bool globMatchAt(const char* pattern, const char* path)
+{
+    while (*pattern) {
+        if (*pattern == '*') {
+            bool crossSeparators = pattern[1] == '*';
+            pattern += crossSeparators ? 2 : 1;
+            // try every possible length of the sequence, shortest first
+            for (;; ++path) {
+                if (globMatchAt(pattern, path)) return true;
+                if (!*path || (!crossSeparators && isPathSep(*path))) return false;
+            }
+        }
+
+        if (!*path) return false;
+        if (*pattern == '?') {
+            if (isPathSep(*path)) return false;
+        }
+        else if (!pathCharsEqual(*pattern, *path)) {
+            return false;
+        }
+        ++pattern;
+        ++path;
+    }
+
+    return !*path;
+}
+
+bool globMatch(const std::string& pattern, const std::string& path)
+{
+    return globMatchAt(pattern.c_str(), path.c_str());
+}
+
+std::string globLiteralPrefix(const std::string& pattern)
+{
+    return pattern.substr(0, pattern.find_first_of("*?"));
+}
+
 void stringToLower(std::string& str)
 {
     std::transform(str.begin(), str.end(), str.begin(), ::tolower);
@@ -126,3 +218,66 @@ void formatBytes(std::ostream& out, const unsigned char *data, size_t dataLen, b
         out << std::endl;
     }
 }
+
+void bytesToHex(char *out, const unsigned char *data, size_t dataLen)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < dataLen; ++i) {
+        *out++ = digits[data[i] >> 4];
+        *out++ = digits[data[i] & 0x0F];
+    }
+    *out = '\0';
+}
+
+bool hexToBytes(unsigned char *out, const char *hex, size_t dataLen)
+{
+    for (size_t i = 0; i < dataLen * 2; ++i) {
+        char ch = hex[i];
+        int nibble;
+        if (ch >= '0' && ch <= '9') nibble = ch - '0';
+        else if (ch >= 'a' && ch <= 'f') nibble = ch - 'a' + 10;
+        else if (ch >= 'A' && ch <= 'F') nibble = ch - 'A' + 10;
+        else return false;
+
+        if (i % 2 == 0) out[i / 2] = static_cast<unsigned char>(nibble << 4);
+        else out[i / 2] |= static_cast<unsigned char>(nibble);
+    }
+    return hex[dataLen * 2] == '\0';
+}
+
+bool setThreadPriority(SchedPriority priority)
+{
+    if (priority == SchedPriority::Normal) return true;
+
+#ifdef __linux__
+    // all of these apply to the calling thread only
+    const int ioprioWhoProcess = 1;
+    const int ioprioClassBestEffort = 2;
+    const int ioprioClassIdle = 3;
+    const int ioprioClassShift = 13;
+    bool result = true;
+    if (priority == SchedPriority::Idle) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        result &= sched_setscheduler(0, SCHED_IDLE, &param) == 0;
+        result &= syscall(SYS_ioprio_set, ioprioWhoProcess, 0, ioprioClassIdle << ioprioClassShift) == 0;
+    }
+    else {
+        result &= setpriority(PRIO_PROCESS, 0, 19) == 0;
+        result &= syscall(SYS_ioprio_set, ioprioWhoProcess, 0, (ioprioClassBestEffort << ioprioClassShift) | 7) == 0;
+    }
+    return result;
+#elif defined(__APPLE__)
+    if (priority == SchedPriority::Idle) {
+        return setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG) == 0;
+    }
+    return setpriority(PRIO_PROCESS, 0, 19) == 0;
+#elif defined(WIN32)
+    if (priority == SchedPriority::Idle) {
+        return SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN) != 0;
+    }
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST) != 0;
+#else
+    return false;
+#endif
+}
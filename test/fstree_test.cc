@@ -0,0 +1,194 @@
+/**
+ * @brief Behaviour of the cascfs file tree - path lookup, content sharing and directory entries
+ *
+ * Usage: stormex_fstree_test
+ *   Exits with non zero status if any of the checks fails, registered with ctest.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "fstree.hpp"
+
+static size_t failures = 0;
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            ++failures; \
+        } \
+    } while (0)
+
+static void setKey(CASC_CKEY_ENTRY& ckeyEntry, uint64_t value)
+{
+    memset(&ckeyEntry, 0, sizeof(ckeyEntry));
+    // spread over the bytes used by the hasher and by the shard selection
+    uint64_t key = (value + 1) * 0x9E3779B97F4A7C15ULL;
+    memcpy(ckeyEntry.CKey, &key, sizeof(key));
+    memcpy(ckeyEntry.CKey + sizeof(key), &key, sizeof(key));
+}
+
+static FsNode* insertPath(FsTree& tree, const std::string& filename, PCASC_CKEY_ENTRY ckeyEntry)
+{
+    auto parentNode = tree.GetParentNodeOfFilename(filename);
+    size_t pos = filename.find_last_of(":\\");
+    return tree.InsertFile(parentNode, pos == std::string::npos ? filename : filename.substr(pos + 1), ckeyEntry, NULL);
+}
+
+static void testLookup()
+{
+    FsTree tree;
+    CASC_CKEY_ENTRY ckeyEntries[3];
+    for (size_t i = 0; i < 3; ++i) setKey(ckeyEntries[i], i);
+
+    auto fileNode = insertPath(tree, "mods\\Core.SC2Mod\\Base.SC2Data\\GameData.xml", &ckeyEntries[0]);
+    auto rootFile = insertPath(tree, "ROOT", &ckeyEntries[1]);
+    auto archiveFile = insertPath(tree, "versions.osxarchive:Contents\\Info.plist", &ckeyEntries[2]);
+
+    CHECK(tree.GetNodeAtPath("/") == tree.GetRootNode());
+    CHECK(tree.GetNodeAtPath("/mods/Core.SC2Mod/Base.SC2Data/GameData.xml") == fileNode);
+    CHECK(tree.GetNodeAtPath("/MODS/core.sc2mod/base.sc2data/gamedata.XML") == fileNode);
+    CHECK(tree.GetNodeAtPath("\\mods\\core.sc2mod\\base.sc2data\\gamedata.xml") == fileNode);
+    CHECK(tree.GetNodeAtPath("/root") == rootFile);
+    // ':' separates components just like '\\'
+    CHECK(tree.GetNodeAtPath("/versions.osxarchive/contents/info.plist") == archiveFile);
+
+    auto folderNode = tree.GetNodeAtPath("/mods/core.sc2mod");
+    CHECK(folderNode != NULL && folderNode->m_kind == FsNodeKind::Folder);
+    CHECK(folderNode != NULL && folderNode->Name() == "Core.SC2Mod");
+    CHECK(fileNode->Filepath() == "/mods/Core.SC2Mod/Base.SC2Data/GameData.xml");
+
+    CHECK(tree.GetNodeAtPath("/mods/core.sc2mod/gamedata.xml") == NULL);
+    CHECK(tree.GetNodeAtPath("/mods/core.sc2mod/base.sc2data/gamedata.xm") == NULL);
+    CHECK(tree.GetNodeAtPath("mods/core.sc2mod") == NULL);
+
+    // folders are shared regardless of the case they're referenced with
+    CHECK(tree.GetParentNodeOfFilename("MODS\\CORE.SC2MOD\\x") == folderNode);
+}
+
+static void testSharedContent()
+{
+    FsTree tree;
+    CASC_CKEY_ENTRY ckeyEntries[2];
+    setKey(ckeyEntries[0], 0);
+    setKey(ckeyEntries[1], 1);
+    // another entry of the same CKey, as found in a different storage
+    CASC_CKEY_ENTRY sameEntry = ckeyEntries[0];
+
+    auto first = insertPath(tree, "enus.sc2data\\a.txt", &ckeyEntries[0]);
+    auto second = insertPath(tree, "dede.sc2data\\a.txt", &sameEntry);
+    auto other = insertPath(tree, "dede.sc2data\\b.txt", &ckeyEntries[1]);
+
+    CHECK(first->content == second->content);
+    CHECK(first->inode == second->inode);
+    CHECK(first->content->nlink == 2);
+    CHECK(other->content != first->content);
+    CHECK(other->content->nlink == 1);
+    CHECK(tree.GetContentCount() == 2);
+
+    // same path inserted again replaces the node - the previous one no longer links to its content
+    auto replaced = insertPath(tree, "DEDE.SC2DATA\\A.TXT", &ckeyEntries[1]);
+    CHECK(tree.GetNodeAtPath("/dede.sc2data/a.txt") == replaced);
+    CHECK(first->content->nlink == 1);
+    CHECK(replaced->content == other->content);
+    CHECK(other->content->nlink == 2);
+
+    // content without any nodes left is dropped
+    insertPath(tree, "enus.sc2data\\a.txt", &ckeyEntries[1]);
+    CHECK(tree.GetContentCount() == 1);
+    CHECK(other->content->nlink == 3);
+}
+
+static void testEntries()
+{
+    FsTree tree;
+    std::vector<CASC_CKEY_ENTRY> ckeyEntries(4);
+    for (size_t i = 0; i < ckeyEntries.size(); ++i) setKey(ckeyEntries[i], i);
+
+    const char* names[] = { "c.txt", "A.txt", "b.txt" };
+    auto folderNode = tree.InsertFolder(tree.GetRootNode(), "dir");
+    for (size_t i = 0; i < 3; ++i) {
+        tree.InsertFile(folderNode, names[i], &ckeyEntries[i], NULL);
+    }
+
+    // readdir resumes at an index into the entries - they keep the insertion order
+    const auto& entries = folderNode->Entries();
+    CHECK(entries.size() == 3);
+    for (size_t i = 0; i < entries.size() && i < 3; ++i) {
+        CHECK(entries[i]->Name() == names[i]);
+    }
+
+    // replaced node takes the position of the previous one, offsets of the others don't shift
+    auto replaced = tree.InsertFile(folderNode, "a.TXT", &ckeyEntries[3], NULL);
+    CHECK(entries.size() == 3);
+    CHECK(entries.size() == 3 && entries[1] == replaced);
+    CHECK(entries.size() == 3 && entries[0]->Name() == "c.txt" && entries[2]->Name() == "b.txt");
+    CHECK(folderNode->Children().size() == 3);
+}
+
+static void testParallelInsert()
+{
+    const size_t threadCount = 8;
+    const size_t filesPerThread = 2000;
+
+    FsTree tree;
+    std::vector<CASC_CKEY_ENTRY> ckeyEntries(threadCount * filesPerThread);
+    for (size_t i = 0; i < ckeyEntries.size(); ++i) {
+        // every other file shares content with a file of another thread
+        setKey(ckeyEntries[i], i % 2 ? i : i % filesPerThread);
+    }
+
+    // each thread builds its own subtree, as cascfs_populate() does
+    std::vector<FsNode*> baseNodes;
+    for (size_t t = 0; t < threadCount; ++t) {
+        baseNodes.push_back(tree.InsertFolder(tree.GetRootNode(), "t" + std::to_string(t)));
+    }
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            for (size_t i = 0; i < filesPerThread; ++i) {
+                std::string dirname = "d" + std::to_string(i % 7) + "\\e" + std::to_string(i % 3);
+                auto parentNode = tree.GetFolderNode(baseNodes[t], dirname.data(), dirname.size());
+                tree.InsertFile(parentNode, "f" + std::to_string(i), &ckeyEntries[t * filesPerThread + i], NULL);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    size_t found = 0;
+    for (size_t t = 0; t < threadCount; ++t) {
+        for (size_t i = 0; i < filesPerThread; ++i) {
+            std::string path = "/T" + std::to_string(t) + "/D" + std::to_string(i % 7) + "/E" + std::to_string(i % 3) + "/F" + std::to_string(i);
+            auto fNode = tree.GetNodeAtPath(path.c_str());
+            if (fNode != NULL && fNode->m_kind == FsNodeKind::File) {
+                uint32_t expectedLinks = i % 2 ? 1 : threadCount;
+                found += fNode->content->nlink == expectedLinks && fNode->inode == fNode->content->inode;
+            }
+        }
+    }
+    CHECK(found == threadCount * filesPerThread);
+    CHECK(tree.GetContentCount() == filesPerThread / 2 + threadCount * filesPerThread / 2);
+    // root, thread folders, 7 + 21 folders per thread and the files
+    CHECK(tree.GetNodeCount() == 1 + threadCount * (1 + 7 + 21 + filesPerThread));
+}
+
+int main(int argc, char* argv[])
+{
+    testLookup();
+    testSharedContent();
+    testEntries();
+    testParallelInsert();
+
+    if (failures) {
+        fprintf(stderr, "%zu checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}